@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OBJECTS 1000000
+
+static size_t rss_bytes(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return 0;
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Mostly pointer-sized nodes and short strings, with a tail up to 1 KiB
+static size_t pick_size(unsigned *seed)
+{
+    unsigned r = (unsigned)rand_r(seed);
+    switch (r % 10)
+    {
+    case 0:
+    case 1:
+        return 8;
+    case 2:
+    case 3:
+    case 4:
+        return (r >> 8) % 64 + 1;
+    case 5:
+    case 6:
+    case 7:
+        return (r >> 8) % 192 + 65;
+    default:
+        return (r >> 8) % 768 + 257;
+    }
+}
+
+static void report(const char *phase, size_t requested, size_t base)
+{
+    size_t rss = rss_bytes() - base;
+    printf("%-12s %14zu %14zu %9.1f%%\n", phase, requested, rss,
+           requested ? 100.0 * ((double)rss - (double)requested)
+                   / (double)requested
+                     : 0.0);
+}
+
+// Fills a heap with small objects, then frees every other one, and reports
+// how much resident memory each phase costs over the bytes requested.
+int main(void)
+{
+    void **objs = calloc(OBJECTS, sizeof(void *));
+    size_t *sizes = calloc(OBJECTS, sizeof(size_t));
+    if (objs == NULL || sizes == NULL)
+        return 1;
+
+    size_t base = rss_bytes();
+    unsigned seed = 42;
+    size_t requested = 0;
+
+    printf("%-12s %14s %14s %10s\n", "phase", "requested", "rss", "overhead");
+
+    for (size_t i = 0; i < OBJECTS; i++)
+    {
+        sizes[i] = pick_size(&seed);
+        objs[i] = malloc(sizes[i]);
+        if (objs[i] == NULL)
+            return 1;
+        memset(objs[i], 1, sizes[i]);
+        requested += sizes[i];
+    }
+    report("filled", requested, base);
+
+    for (size_t i = 0; i < OBJECTS; i += 2)
+    {
+        free(objs[i]);
+        requested -= sizes[i];
+    }
+    report("half freed", requested, base);
+
+    for (size_t i = 1; i < OBJECTS; i += 2)
+        free(objs[i]);
+
+    free(sizes);
+    free(objs);
+    return 0;
+}
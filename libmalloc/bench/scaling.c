@@ -0,0 +1,72 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define OPS_PER_THREAD 2000000
+#define LIVE_SLOTS 256
+#define MAX_THREADS 256
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Each thread keeps a small working set of small blocks and replaces one at
+// random per iteration, which is the allocation pattern the caches target.
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(size_t)arg;
+    void *live[LIVE_SLOTS] = { 0 };
+
+    for (long i = 0; i < OPS_PER_THREAD; i++)
+    {
+        unsigned r = (unsigned)rand_r(&seed);
+        size_t slot = r % LIVE_SLOTS;
+        free(live[slot]);
+        live[slot] = malloc((r >> 8) % 512 + 1);
+        if (live[slot] == NULL)
+            abort();
+        *(char *)live[slot] = 1;
+    }
+
+    for (size_t i = 0; i < LIVE_SLOTS; i++)
+        free(live[i]);
+    return NULL;
+}
+
+static double run(int threads)
+{
+    pthread_t tids[MAX_THREADS];
+    double start = now();
+
+    for (int i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, worker, (void *)(size_t)(i + 1));
+    for (int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    return (double)OPS_PER_THREAD * threads / (now() - start);
+}
+
+int main(int argc, char **argv)
+{
+    printf("%8s %16s %10s\n", "threads", "ops/sec", "speedup");
+
+    double base = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        int threads = atoi(argv[i]);
+        if (threads <= 0 || threads > MAX_THREADS)
+            continue;
+
+        double ops = run(threads);
+        if (base == 0)
+            base = ops / threads;
+        printf("%8d %16.0f %9.2fx\n", threads, ops, ops / base);
+    }
+
+    return 0;
+}
@@ -0,0 +1,344 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_THREADS 256
+
+// Every SAMPLE_EVERY-th operation is timed on its own for the percentiles
+#define SAMPLE_EVERY 16
+
+#define LARSON_OPS 1000000
+#define LARSON_SLOTS 1000
+#define LARSON_ROUNDS 4
+
+#define XMALLOC_OPS 1000000
+#define XMALLOC_RING 1024
+
+#define CLASS_OPS 200000
+#define CLASS_BATCH 100
+
+#define REALLOC_CYCLES 2000
+#define REALLOC_MAX (1024 * 1024)
+
+// Batch entry points of tinymalloc, NULL when running on another allocator
+extern size_t tinymalloc_alloc_batch(size_t size, size_t n, void **ptrs)
+    __attribute__((weak));
+extern void tinymalloc_free_batch(void **ptrs, size_t n) __attribute__((weak));
+
+static const size_t class_sizes[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Per-thread state of a run: its latency samples and its arguments.
+ */
+struct worker
+{
+    int id; ///< Index of the thread in the run.
+    int threads; ///< Threads of the run.
+    size_t size; ///< Block size, for the workloads that take one.
+    long ops; ///< Operations performed.
+    uint32_t *samples; ///< Sampled operation latencies, in ns.
+    size_t nsamples; ///< Number of samples taken.
+    size_t max_samples; ///< Room in samples.
+};
+
+static void sample(struct worker *w, uint64_t start)
+{
+    uint64_t ns = now_ns() - start;
+    if (ns > UINT32_MAX)
+        ns = UINT32_MAX;
+    if (w->nsamples < w->max_samples)
+        w->samples[w->nsamples++] = (uint32_t)ns;
+}
+
+// Times one operation out of SAMPLE_EVERY
+#define TIMED(w, i, op)                                                        \
+    do                                                                         \
+    {                                                                          \
+        if ((i) % SAMPLE_EVERY == 0)                                           \
+        {                                                                      \
+            uint64_t t0_ = now_ns();                                           \
+            op;                                                                \
+            sample((w), t0_);                                                  \
+        }                                                                      \
+        else                                                                   \
+            op;                                                                \
+    } while (0)
+
+static void *checked(void *p)
+{
+    if (p == NULL)
+        abort();
+    *(volatile char *)p = 1;
+    return p;
+}
+
+// Larson: each thread serves a set of slots, replacing a random block per
+// operation, then exits and a new thread takes over the set and frees what
+// its predecessor allocated.
+static void *larson_slots[MAX_THREADS][LARSON_SLOTS];
+
+static void *larson(void *arg)
+{
+    struct worker *w = arg;
+    void **slots = larson_slots[w->id];
+    unsigned seed = (unsigned)w->id * 7919u + (unsigned)w->ops + 1;
+    long n = LARSON_OPS / LARSON_ROUNDS;
+
+    for (long i = 0; i < n; i++)
+    {
+        unsigned r = (unsigned)rand_r(&seed);
+        size_t slot = r % LARSON_SLOTS;
+        size_t size = (r >> 10) % 1009 + 16;
+        TIMED(w, i, free(slots[slot]); slots[slot] = checked(malloc(size)));
+    }
+
+    w->ops += n;
+    return NULL;
+}
+
+// Xmalloc: every thread allocates into a ring read by the next thread, which
+// frees the blocks, so nearly every free is a remote one.
+struct ring
+{
+    void *slots[XMALLOC_RING];
+    size_t head; ///< Next slot to read, written by the consumer.
+    size_t tail; ///< Next slot to write, written by the producer.
+    int done; ///< Set once the producer has pushed everything.
+};
+
+static struct ring rings[MAX_THREADS];
+
+static int ring_pop_free(struct ring *r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    free(r->slots[head % XMALLOC_RING]);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void *xmalloc(void *arg)
+{
+    struct worker *w = arg;
+    struct ring *out = &rings[(w->id + 1) % w->threads];
+    struct ring *in = &rings[w->id];
+    unsigned seed = (unsigned)w->id + 1;
+
+    for (long i = 0; i < XMALLOC_OPS; i++)
+    {
+        size_t size = (size_t)rand_r(&seed) % 512 + 1;
+        void *p;
+        TIMED(w, i, p = checked(malloc(size)));
+
+        size_t tail = out->tail;
+        // Full ring: free our own input meanwhile, the ring may be our own
+        while (tail - __atomic_load_n(&out->head, __ATOMIC_ACQUIRE)
+               >= XMALLOC_RING)
+            if (!ring_pop_free(in))
+                sched_yield();
+
+        out->slots[tail % XMALLOC_RING] = p;
+        __atomic_store_n(&out->tail, tail + 1, __ATOMIC_RELEASE);
+        ring_pop_free(in);
+    }
+    __atomic_store_n(&out->done, 1, __ATOMIC_RELEASE);
+
+    // Done is read first: once set, an empty ring stays empty
+    for (;;)
+    {
+        int done = __atomic_load_n(&in->done, __ATOMIC_ACQUIRE);
+        if (ring_pop_free(in))
+            continue;
+        if (done)
+            break;
+        sched_yield();
+    }
+
+    w->ops = XMALLOC_OPS;
+    return NULL;
+}
+
+// Alloc/free loop on a single size class, in batches
+static void *classes(void *arg)
+{
+    struct worker *w = arg;
+    void *batch[CLASS_BATCH];
+    long i = 0;
+
+    while (i < CLASS_OPS)
+    {
+        for (int j = 0; j < CLASS_BATCH; j++, i++)
+            TIMED(w, i, batch[j] = checked(malloc(w->size)));
+        for (int j = 0; j < CLASS_BATCH; j++, i++)
+            TIMED(w, i, free(batch[j]));
+    }
+
+    w->ops = i;
+    return NULL;
+}
+
+// The same loop through the batch calls, a sampled latency covers a batch
+static void *batches(void *arg)
+{
+    struct worker *w = arg;
+    void *batch[CLASS_BATCH];
+    long i = 0;
+
+    for (long b = 0; i < CLASS_OPS; b++, i += 2 * CLASS_BATCH)
+    {
+        size_t n;
+        TIMED(w, b, n = tinymalloc_alloc_batch(w->size, CLASS_BATCH, batch));
+        if (n != CLASS_BATCH)
+            abort();
+        for (int j = 0; j < CLASS_BATCH; j++)
+            *(volatile char *)batch[j] = 1;
+        TIMED(w, b, tinymalloc_free_batch(batch, CLASS_BATCH));
+    }
+
+    w->ops = i;
+    return NULL;
+}
+
+// A buffer grown by half its size until REALLOC_MAX, as vectors and string
+// builders do
+static void *grow(void *arg)
+{
+    struct worker *w = arg;
+    long ops = 0;
+
+    for (int c = 0; c < REALLOC_CYCLES; c++)
+    {
+        char *buf = NULL;
+        for (size_t size = 16; size <= REALLOC_MAX; size += size / 2, ops++)
+        {
+            TIMED(w, ops, buf = checked(realloc(buf, size)));
+            buf[size - 1] = 1;
+        }
+        free(buf);
+    }
+
+    w->ops = ops;
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, size_t size, int threads,
+                   struct worker *w, double seconds)
+{
+    long ops = 0;
+    size_t n = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        ops += w[i].ops;
+        n += w[i].nsamples;
+    }
+
+    uint32_t *all = malloc((n ? n : 1) * sizeof(*all));
+    if (all == NULL)
+        abort();
+
+    size_t k = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        memcpy(all + k, w[i].samples, w[i].nsamples * sizeof(*all));
+        k += w[i].nsamples;
+    }
+    qsort(all, n, sizeof(*all), cmp_u32);
+
+    uint32_t p50 = n ? all[n / 2] : 0;
+    uint32_t p99 = n ? all[n * 99 / 100] : 0;
+    uint32_t p999 = n ? all[n * 999 / 1000] : 0;
+    printf("%-8s %7zu %8d %14.0f %9u %9u %9u\n", name, size, threads,
+           (double)ops / seconds, p50, p99, p999);
+    free(all);
+}
+
+static void run(const char *name, void *(*fn)(void *), size_t size,
+                int threads, long max_ops, int rounds)
+{
+    static struct worker w[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+
+    for (int i = 0; i < threads; i++)
+    {
+        memset(&w[i], 0, sizeof(w[i]));
+        w[i].id = i;
+        w[i].threads = threads;
+        w[i].size = size;
+        w[i].max_samples = (size_t)(max_ops / SAMPLE_EVERY + 1);
+        w[i].samples = malloc(w[i].max_samples * sizeof(uint32_t));
+        if (w[i].samples == NULL)
+            abort();
+    }
+    memset(rings, 0, sizeof(rings));
+
+    double start = (double)now_ns();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < threads; i++)
+            pthread_create(&tids[i], NULL, fn, &w[i]);
+        for (int i = 0; i < threads; i++)
+            pthread_join(tids[i], NULL);
+    }
+    double seconds = ((double)now_ns() - start) / 1e9;
+
+    report(name, size, threads, w, seconds);
+    for (int i = 0; i < threads; i++)
+        free(w[i].samples);
+}
+
+// Runs every workload for each thread count given on the command line
+int main(int argc, char **argv)
+{
+    printf("%-8s %7s %8s %14s %9s %9s %9s\n", "workload", "size",
+           "threads", "ops/sec", "p50_ns", "p99_ns", "p99.9_ns");
+
+    for (int a = 1; a < argc; a++)
+    {
+        int threads = atoi(argv[a]);
+        if (threads <= 0 || threads > MAX_THREADS)
+            continue;
+
+        run("larson", larson, 0, threads, LARSON_OPS, LARSON_ROUNDS);
+        for (int t = 0; t < threads; t++)
+            for (int s = 0; s < LARSON_SLOTS; s++)
+            {
+                free(larson_slots[t][s]);
+                larson_slots[t][s] = NULL;
+            }
+
+        run("xmalloc", xmalloc, 0, threads, XMALLOC_OPS, 1);
+
+        for (size_t s = 0; s < sizeof(class_sizes) / sizeof(*class_sizes);
+             s++)
+            run("class", classes, class_sizes[s], threads, CLASS_OPS, 1);
+
+        if (tinymalloc_alloc_batch != NULL && tinymalloc_free_batch != NULL)
+            for (size_t s = 0; s < sizeof(class_sizes) / sizeof(*class_sizes);
+                 s++)
+                run("batch", batches, class_sizes[s], threads, CLASS_OPS, 1);
+
+        run("realloc", grow, REALLOC_MAX, threads, REALLOC_CYCLES * 64, 1);
+    }
+
+    return 0;
+}
@@ -1,3 +1,6 @@
+// mremap is a GNU extension
+#define _GNU_SOURCE
+
 #include "blk_allocator.h"
 
 #include <sys/mman.h>
@@ -6,79 +9,189 @@
 #include <limits.h>
 #include <stddef.h>
 
-#include "my_recycler.h"
+#include "my_conf.h"
 #include "tools.h"
 
-static size_t check_overflow_add(size_t a, size_t b)
+// System calls made for the mappings, read by blka_counts
+static uint64_t map_calls;
+static uint64_t unmap_calls;
+
+static void *sys_map(size_t len, int flags)
 {
-    size_t sum;
-#if __SIZEOF_SIZE_T__ == 8
-    if (__builtin_uaddl_overflow(a, b, &sum)) return 0;
-#else
-    if (__builtin_uadd_overflow(a, b, &sum)) return 0;
-#endif
-    return sum;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    map_calls++;
+    return p;
 }
 
-void blka_free(struct blk_meta *block)
+static int sys_unmap(void *p, size_t len)
 {
-    // If there are no mappings in the specified address range, then munmap()
-    // has no effect.
-    munmap(block, (block->size + sizeof(struct blk_meta)));
+    unmap_calls++;
+    return munmap(p, len);
 }
 
-struct blk_meta *blka_alloc(struct blk_allocator *allocator, size_t size)
+// Tail of the current region, mappings shorter than a region are carved from
+// it. Only used under the allocator lock.
+static char *region_next;
+static size_t region_left;
+static int hugetlb_failed;
+
+// Maps len bytes aligned to HUGE_REGION_SIZE, hinted for transparent huge
+// pages
+static void *map_thp(size_t len)
 {
-    if (allocator == NULL)
+    if (len > SIZE_MAX - HUGE_REGION_SIZE)
         return NULL;
 
-    size_t ps = tools_page_size();
-    if (ps == 0)
+    char *raw = sys_map(len + HUGE_REGION_SIZE, 0);
+    if (raw == NULL)
         return NULL;
 
-    size_t hdr = size_align(sizeof(struct blk_meta) + sizeof(struct recycler));
-    if (hdr == 0)
-        return NULL;
+    uintptr_t aligned = ((uintptr_t)raw + (HUGE_REGION_SIZE - 1))
+        & ~(uintptr_t)(HUGE_REGION_SIZE - 1);
+    char *base = (char *)aligned;
+    size_t head = (size_t)(base - raw);
+    if (head != 0)
+        sys_unmap(raw, head);
+    sys_unmap(base + len, HUGE_REGION_SIZE - head);
 
-    size_t total = check_overflow_add(size, hdr);
-    if (total == 0)
-        return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(base, len, MADV_HUGEPAGE);
+#endif
+    return base;
+}
 
-    // Round up to page size without overflow: total + (ps-1)
-    if (total > SIZE_MAX - (ps - 1))
-        return NULL;
+// Mappings of a region or more, already rounded to whole regions, get huge
+// pages of their own, preferably from the hugetlb pool. Shorter ones are
+// carved from a transparent huge page region: a piece can be unmapped on its
+// own, which a hugetlb page cannot.
+static void *map_huge(size_t len)
+{
+    if (len >= HUGE_REGION_SIZE)
+    {
+#ifdef MAP_HUGETLB
+        if (!hugetlb_failed)
+        {
+            void *p = sys_map(len, MAP_HUGETLB);
+            if (p != NULL)
+                return p;
+            // No reserved huge pages, do not ask again
+            hugetlb_failed = 1;
+        }
+#endif
+        return map_thp(len);
+    }
+
+    if (region_left < len)
+    {
+        char *region = map_thp(HUGE_REGION_SIZE);
+        if (region == NULL)
+            return NULL;
+        if (region_left != 0)
+            sys_unmap(region_next, region_left);
+        region_next = region;
+        region_left = HUGE_REGION_SIZE;
+    }
+
+    void *p = region_next;
+    region_next += len;
+    region_left -= len;
+    return p;
+}
 
-    size_t map_len = (total + (ps - 1)) & ~(ps - 1);
-    if (map_len <= sizeof(struct blk_meta))
+static void *map_pages(size_t len)
+{
+    if (conf.huge_pages)
+        return map_huge(len);
+    return sys_map(len, 0);
+}
+
+size_t blka_map_size(size_t len)
+{
+    size_t ps = tools_page_size();
+    if (ps == 0 || len == 0)
+        return 0;
+
+    // Round up to page size without overflow: len + (ps-1)
+    if (len > SIZE_MAX - (ps - 1))
+        return 0;
+
+    size_t map_len = (len + (ps - 1)) & ~(ps - 1);
+    // Mappings of a region or more are whole huge pages
+    if (conf.huge_pages && map_len >= HUGE_REGION_SIZE)
+    {
+        if (map_len > SIZE_MAX - (HUGE_REGION_SIZE - 1))
+            return 0;
+        map_len = (map_len + (HUGE_REGION_SIZE - 1))
+            & ~(HUGE_REGION_SIZE - 1);
+    }
+    return map_len;
+}
+
+void *blka_map(size_t len)
+{
+    size_t ps = tools_page_size();
+    if (ps == 0 || len == 0 || len % ps != 0)
         return NULL;
+    return map_pages(len);
+}
 
-    struct blk_meta *m = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
-                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (m == MAP_FAILED)
+void *blka_map_aligned(size_t len, size_t align)
+{
+    size_t ps = tools_page_size();
+    if (ps == 0 || align <= ps || (align & (align - 1)) != 0 || len == 0
+        || len % ps != 0 || len > SIZE_MAX - align)
         return NULL;
 
-    m->size = map_len - sizeof(struct blk_meta);
-    m->prev = NULL;
-    m->next = allocator->meta;
-    if (allocator->meta)
-        allocator->meta->prev = m;
-    allocator->meta = m;
+    // Map align bytes more than needed, then unmap what lies around the
+    // aligned part
+    char *raw = sys_map(len + align, 0);
+    if (raw == NULL)
+        return NULL;
 
-    return m;
+    uintptr_t target = ((uintptr_t)raw + (align - 1)) & ~(align - 1);
+    char *base = (char *)target;
+    size_t head = (size_t)(base - raw);
+    if (head != 0)
+        sys_unmap(raw, head);
+    sys_unmap(base + len, align - head);
+    return base;
 }
 
-void blka_remove(struct blk_allocator *allocator, struct blk_meta *block)
+void blka_unmap(void *addr, size_t len)
 {
-    if (allocator == NULL || block == NULL)
-        return;
-
-    if (block->prev)
-        block->prev->next = block->next;
-    else
-        allocator->meta = block->next;
+    // If there are no mappings in the specified address range, then munmap()
+    // has no effect.
+    sys_unmap(addr, len);
+}
 
-    if (block->next)
-        block->next->prev = block->prev;
+void *blka_remap(void *addr, size_t old_len, size_t len)
+{
+    if (addr == NULL || len == 0)
+        return NULL;
+    if (len == old_len)
+        return addr;
+
+    if (len < old_len)
+    {
+        // Shrinking never moves, the tail pages are simply unmapped
+        if (sys_unmap((char *)addr + len, old_len - len) != 0)
+            return NULL;
+        return addr;
+    }
+
+    // Growing moves page table entries, never the contents
+    void *p = mremap(addr, old_len, len, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED)
+        return NULL;
+    map_calls++;
+    return p;
+}
 
-    blka_free(block);
-}
\ No newline at end of file
+void blka_counts(uint64_t *maps, uint64_t *unmaps)
+{
+    *maps = map_calls;
+    *unmaps = unmap_calls;
+}
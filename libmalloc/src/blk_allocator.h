@@ -2,6 +2,15 @@
 #define ALLOCATOR_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief With huge pages on, mappings are carved from regions of this size,
+ * aligned to it and backed by huge pages.
+ */
+#ifndef HUGE_REGION_SIZE
+#    define HUGE_REGION_SIZE ((size_t)2 * 1024 * 1024)
+#endif
 
 /**
  * @brief Structure representing metadata for a memory block in a block
@@ -11,7 +20,7 @@ struct blk_meta
 {
     struct blk_meta *next; ///< Pointer to the next block in the allocator.
     struct blk_meta *prev; ///< Pointer to the previous block in the allocator.
-    size_t size; ///< Size of the memory block.
+    size_t size; ///< Length of the mapping, in bytes.
 };
 
 /**
@@ -26,35 +35,65 @@ struct blk_allocator
 };
 
 /**
- * @brief Allocates a block of memory of a specified size from the block
- * allocator.
+ * @brief Rounds a length up to that of the mapping blka_map creates for it.
+ *
+ * @param len The number of bytes needed.
+ * @return The mapping length in bytes, whole pages, or whole huge page
+ * regions from HUGE_REGION_SIZE on with conf.huge_pages. 0 on overflow.
+ */
+size_t blka_map_size(size_t len);
+
+/**
+ * @brief Maps anonymous memory, with no header of any kind.
+ *
+ * With conf.huge_pages, mappings shorter than HUGE_REGION_SIZE are carved
+ * from a region hinted with MADV_HUGEPAGE, and longer ones are mapped with
+ * MAP_HUGETLB if huge pages are reserved.
  *
- * @param blka Pointer to the block allocator from which to allocate.
- * @param size The size of the memory block to allocate, in bytes.
- * @return A pointer to the allocated blk_meta structure, or NULL if the
- * allocation fails.
+ * @param len The length, as returned by blka_map_size.
+ * @return The start of the mapping, or NULL if the mapping fails.
  */
-struct blk_meta *blka_alloc(struct blk_allocator *blka, size_t size);
+void *blka_map(size_t len);
 
 /**
- * @brief Frees a block of memory that was allocated with blka_alloc.
+ * @brief Maps anonymous memory like blka_map, aligned beyond the page size.
+ *
+ * @param len The length, a multiple of the page size.
+ * @param align The alignment, a power of two larger than the page size.
+ * @return The start of the mapping, or NULL if the mapping fails.
+ */
+void *blka_map_aligned(size_t len, size_t align);
+
+/**
+ * @brief Unmaps memory mapped with blka_map or blka_map_aligned.
+ *
+ * @param addr Start of the mapping.
+ * @param len Its length, in bytes.
+ */
+void blka_unmap(void *addr, size_t len);
+
+/**
+ * @brief Resizes a mapping made with blka_map.
+ *
+ * A smaller mapping keeps its address and has its tail unmapped, a larger one
+ * is grown with mremap and may move.
  *
- * @param blk Pointer to the blk_meta structure representing the block to be
- * freed.
+ * @param addr Start of the mapping.
+ * @param old_len Its length, in bytes.
+ * @param len The new length, a multiple of the page size.
+ * @return The start of the resized mapping, or NULL if the resize fails, in
+ * which case the mapping is left unchanged.
  */
-void blka_free(struct blk_meta *blk);
+void *blka_remap(void *addr, size_t old_len, size_t len);
 
 /**
- * @brief Removes a block of memory from the block allocator's linked list.
+ * @brief Reads the number of system calls made for the mappings.
  *
- * This function does not free the memory of the block itself; it only removes
- * the block from the allocator's linked list.
+ * Must be called with the allocator lock held.
  *
- * @param blka Pointer to the block allocator from which the block is to be
- * removed.
- * @param blk Pointer to the blk_meta structure representing the block to be
- * removed.
+ * @param maps Receives the number of mmap and mremap calls.
+ * @param unmaps Receives the number of munmap calls.
  */
-void blka_remove(struct blk_allocator *blka, struct blk_meta *blk);
+void blka_counts(uint64_t *maps, uint64_t *unmaps);
 
 #endif /* !ALLOCATOR_H */
@@ -1,25 +1,36 @@
+#include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
-#include <stdatomic.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
 
+#include "my_budget.h"
+#include "my_conf.h"
+#include "my_lock.h"
 #include "my_malloc.h"
+#include "my_percpu.h"
+#include "my_profile.h"
+#include "my_region.h"
+#include "my_stats.h"
+#include "my_tcache.h"
+#include "tinymalloc.h"
+#include "tools.h"
 
 // Non-allocating, re-entrant lock (per-thread depth)
-static atomic_flag g_lock = ATOMIC_FLAG_INIT;
+static struct my_lock g_lock = MY_LOCK_INIT;
 static __thread unsigned g_depth = 0;
 
-#if defined(__x86_64__) || defined(__i386__)
-static inline void cpu_relax(void) { __asm__ __volatile__("pause" ::: "memory"); }
-#else
-static inline void cpu_relax(void) { /* no-op */ }
-#endif
-
 static inline void hook_lock(void)
 {
     if (g_depth++ != 0)
         return; // recursive entry on same thread
 
-    while (atomic_flag_test_and_set_explicit(&g_lock, memory_order_acquire))
-        cpu_relax();
+    lock_acquire(&g_lock);
 }
 
 static inline void hook_unlock(void)
@@ -27,36 +38,840 @@ static inline void hook_unlock(void)
     if (--g_depth != 0)
         return;
 
-    atomic_flag_clear_explicit(&g_lock, memory_order_release);
+    lock_release(&g_lock);
 }
 
-__attribute__((visibility("default"))) void *malloc(size_t size)
+// Thread cache lifecycle: only ACTIVE caches are used, every other state
+// sends the thread down the locked path.
+enum tcache_state
+{
+    TCACHE_UNINIT = 0,
+    TCACHE_INIT, // pthread calls in progress, may recurse into malloc
+    TCACHE_ACTIVE,
+    TCACHE_DEAD, // thread exiting or cache unavailable
+};
+
+#define TLS_IE __attribute__((tls_model("initial-exec")))
+
+static __thread struct tcache g_tcache TLS_IE;
+static __thread enum tcache_state g_tcache_state TLS_IE = TCACHE_UNINIT;
+
+// Allocation counters of the thread, attached on its first cached
+// allocation or free, whichever cache serves it. Same states as the cache.
+static __thread struct stats_counters g_stats TLS_IE;
+static __thread enum tcache_state g_stats_state TLS_IE = TCACHE_UNINIT;
+
+// Bytes the thread allocates before its next sample: with the profiler off
+// the countdown never runs out. It starts at zero, a thread only samples once
+// it drew a first interval.
+static __thread int64_t g_prof_left TLS_IE;
+static __thread int g_prof_seeded TLS_IE;
+
+// Value of budget_epoch when the thread cache last gave its blocks back
+static __thread unsigned g_tcache_epoch TLS_IE;
+
+static pthread_key_t g_tcache_key;
+static pthread_once_t g_tcache_once = PTHREAD_ONCE_INIT;
+static int g_tcache_key_ok = 0;
+
+// Shared by the cache and the counters: whichever the thread set up first
+// registered it
+static void tcache_thread_exit(void *arg)
 {
+    (void)arg;
+    int had_cache = g_tcache_state == TCACHE_ACTIVE;
+    int had_stats = g_stats_state == TCACHE_ACTIVE;
+    g_tcache_state = TCACHE_DEAD;
+    g_stats_state = TCACHE_DEAD;
+
     hook_lock();
-    void *p = my_malloc(size);
+    if (had_cache)
+        tcache_destroy(&g_tcache);
+    if (had_stats)
+        stats_detach(&g_stats);
     hook_unlock();
+}
+
+static void tcache_key_init(void)
+{
+    g_tcache_key_ok =
+        pthread_key_create(&g_tcache_key, tcache_thread_exit) == 0;
+}
+
+static void prof_seed(void)
+{
+    g_prof_left = profile_next_interval();
+    g_prof_seeded = 1;
+}
+
+// Attaches the thread's counters, independently of its cache: threads served
+// by the per-CPU caches never set one up
+static void thread_stats_init(void)
+{
+    if (g_stats_state != TCACHE_UNINIT)
+        return;
+
+    g_stats_state = TCACHE_INIT;
+    prof_seed();
+    pthread_once(&g_tcache_once, tcache_key_init);
+
+    // Without the destructor the counters would go away with the thread
+    // while still attached
+    if (!g_tcache_key_ok || pthread_setspecific(g_tcache_key, &g_stats) != 0)
+    {
+        g_stats_state = TCACHE_DEAD;
+        return;
+    }
+
+    hook_lock();
+    stats_attach(&g_stats);
+    hook_unlock();
+
+    g_stats_state = TCACHE_ACTIVE;
+}
+
+static struct tcache *thread_cache_slow(void)
+{
+    if (g_tcache_state != TCACHE_UNINIT)
+        return NULL;
+
+    g_tcache_state = TCACHE_INIT;
+    pthread_once(&g_tcache_once, tcache_key_init);
+
+    hook_lock();
+    percpu_init();
+    hook_unlock();
+
+    // The key destructor is what hands the cache back on thread exit, without
+    // it the cached blocks would leak.
+    if (!g_tcache_key_ok || pthread_setspecific(g_tcache_key, &g_tcache) != 0)
+    {
+        g_tcache_state = TCACHE_DEAD;
+        return NULL;
+    }
+
+    tcache_init(&g_tcache);
+    g_tcache_epoch = __atomic_load_n(&budget_epoch, __ATOMIC_RELAXED);
+    thread_stats_init();
+
+    g_tcache_state = TCACHE_ACTIVE;
+    return &g_tcache;
+}
+
+static inline struct tcache *thread_cache(void)
+{
+    if (__builtin_expect(g_tcache_state == TCACHE_ACTIVE, 1))
+        return &g_tcache;
+    return thread_cache_slow();
+}
+
+// Threads whose counters are not attached count in the shared ones
+static inline struct stats_counters *thread_stats(void)
+{
+    if (__builtin_expect(g_stats_state == TCACHE_ACTIVE, 1))
+        return &g_stats;
+    return NULL;
+}
+
+// Kept out of line and off the tail position, so that the backtrace always
+// has the same frames to skip: this one and the hook
+static __attribute__((noinline)) void prof_sample(void *p, size_t size)
+{
+    profile_record(p, size);
+    g_prof_left = profile_next_interval();
+}
+
+static inline void *count_malloc(void *p, size_t idx, size_t size)
+{
+    if (p == NULL)
+        return NULL;
+
+    size_t block_size =
+        idx < BUCKET_COUNT ? my_class_size(idx) : my_usable_size(p);
+    stats_count_malloc(thread_stats(), idx, size, block_size);
+
+    g_prof_left -= (int64_t)size;
+    if (__builtin_expect(g_prof_left < 0, 0))
+    {
+        // Threads that only made large allocations have no interval yet
+        if (g_prof_seeded)
+            prof_sample(p, size);
+        else
+            prof_seed();
+    }
     return p;
 }
 
+static inline void count_free(void *ptr, size_t idx)
+{
+    stats_count_free(thread_stats(), idx);
+    if (__builtin_expect(profile_active, 0))
+        profile_free(ptr);
+}
+
+// Must be called with the lock held. A cache asked to flush since it last
+// did gives every block back.
+static void tcache_follow_budget(struct tcache *tc)
+{
+    unsigned epoch = __atomic_load_n(&budget_epoch, __ATOMIC_RELAXED);
+    if (__builtin_expect(epoch == g_tcache_epoch, 1))
+        return;
+
+    g_tcache_epoch = epoch;
+    tcache_destroy(tc);
+}
+
+static void *cached_malloc(struct tcache *tc, size_t idx)
+{
+    void *p = tcache_alloc(tc, idx);
+    if (p != NULL)
+        return p;
+
+    hook_lock();
+    tcache_follow_budget(tc);
+    tcache_refill(tc, idx);
+    hook_unlock();
+
+    return tcache_alloc(tc, idx);
+}
+
+static void *percpu_malloc(size_t idx)
+{
+    void *p = percpu_alloc(idx);
+    if (p != NULL)
+        return p;
+
+    void *batch[PERCPU_CAPACITY];
+    hook_lock();
+    size_t n = my_malloc_batch(idx, batch, percpu_limit(idx) / 2 + 1, 0);
+    hook_unlock();
+
+    if (n == 0)
+        return NULL;
+
+    // We may have migrated since the refill, whatever does not fit goes back
+    size_t i = 1;
+    while (i < n && percpu_free(idx, batch[i]))
+        i++;
+
+    if (i < n)
+    {
+        hook_lock();
+        while (i < n)
+            my_free(batch[i++]);
+        hook_unlock();
+    }
+
+    return batch[0];
+}
+
+static void percpu_cached_free(size_t idx, void *ptr)
+{
+    if (percpu_free(idx, ptr))
+        return;
+
+    // Bin full: drain half of it along with the block in one critical section
+    void *batch[PERCPU_CAPACITY];
+    size_t n = 0;
+    size_t half = percpu_limit(idx) / 2;
+    while (n < half && (batch[n] = percpu_alloc(idx)) != NULL)
+        n++;
+
+    hook_lock();
+    for (size_t i = 0; i < n; i++)
+        my_free(batch[i]);
+    my_free(ptr);
+    hook_unlock();
+}
+
+// Serves a cached class from the per-CPU or the thread cache. Returns 0 when
+// neither is usable and the caller must take the locked path.
+static int cached_class_malloc(size_t idx, void **out)
+{
+    if (percpu_available())
+    {
+        if (__builtin_expect(g_stats_state == TCACHE_UNINIT, 0))
+            thread_stats_init();
+        *out = percpu_malloc(idx);
+        return 1;
+    }
+
+    struct tcache *tc = thread_cache();
+    if (tc == NULL)
+        return 0;
+
+    *out = cached_malloc(tc, idx);
+    return 1;
+}
+
+__attribute__((visibility("default"))) void *malloc(size_t size)
+{
+    void *p = NULL;
+    size_t idx = my_size_class(size);
+    if (idx < CACHE_CLASS_COUNT && cached_class_malloc(idx, &p))
+        return count_malloc(p, idx, size);
+
+    hook_lock();
+    p = my_malloc(size);
+    hook_unlock();
+    return count_malloc(p, idx, size);
+}
+
+// The class counts from the 16-byte one, whatever the build
+__attribute__((visibility("default"))) void *
+tinymalloc_class_malloc(size_t cls, size_t size)
+{
+    void *p = NULL;
+    size_t idx = cls + TINY_CLASS_COUNT;
+    if (idx < CACHE_CLASS_COUNT && cached_class_malloc(idx, &p))
+        return count_malloc(p, idx, size);
+    return malloc(size);
+}
+
 __attribute__((visibility("default"))) void free(void *ptr)
 {
+    if (ptr == NULL)
+        return;
+
+    size_t idx = my_block_class(ptr);
+    if (idx == BUCKET_COUNT && my_usable_size(ptr) == 0)
+        return; // not a block of ours
+    count_free(ptr, idx);
+
+    if (idx < CACHE_CLASS_COUNT)
+    {
+        if (percpu_available())
+        {
+            if (__builtin_expect(g_stats_state == TCACHE_UNINIT, 0))
+                thread_stats_init();
+            percpu_cached_free(idx, ptr);
+            return;
+        }
+
+        struct tcache *tc = thread_cache();
+        if (tc != NULL)
+        {
+            // Pages another thread refills from take their blocks back
+            // through the lock-free remote list
+            uintptr_t owner = my_block_owner(ptr);
+            if (owner != 0 && owner != (uintptr_t)tc)
+            {
+                my_free_remote(ptr);
+                return;
+            }
+
+            if (tcache_free(tc, idx, ptr))
+                return;
+
+            hook_lock();
+            tcache_follow_budget(tc);
+            tcache_flush(tc, idx);
+            hook_unlock();
+
+            if (tcache_free(tc, idx, ptr))
+                return;
+        }
+    }
+
     hook_lock();
     my_free(ptr);
     hook_unlock();
 }
 
+// A realloc counts as the free of the old block and the allocation of the
+// new one, even when the block stays in place
 __attribute__((visibility("default"))) void *realloc(void *ptr, size_t size)
 {
+    size_t old = BUCKET_COUNT;
+    int known = 0;
+    if (ptr != NULL)
+    {
+        old = my_block_class(ptr);
+        known = old < BUCKET_COUNT || my_usable_size(ptr) != 0;
+    }
+
     hook_lock();
     void *p = my_realloc(ptr, size);
     hook_unlock();
+
+    if (known && (p != NULL || size == 0))
+        count_free(ptr, old);
+    if (p != NULL)
+        count_malloc(p, my_block_class(p), size);
     return p;
 }
 
 __attribute__((visibility("default"))) void *calloc(size_t nmemb, size_t size)
 {
+    void *p = NULL;
+    if (nmemb == 0 || size <= SIZE_MAX / nmemb)
+    {
+        size_t total = nmemb * size;
+        size_t idx = my_size_class(total);
+        if (idx < CACHE_CLASS_COUNT && cached_class_malloc(idx, &p))
+        {
+            if (p != NULL)
+                memset(p, 0, total);
+            return count_malloc(p, idx, total);
+        }
+    }
+
     hook_lock();
-    void *p = my_calloc(nmemb, size);
+    p = my_calloc(nmemb, size);
     hook_unlock();
-    return p;
+    return p != NULL ? count_malloc(p, my_block_class(p), nmemb * size) : NULL;
+}
+
+// Aligned classes come from the caches like any other, only large blocks
+// and page-plus alignments take the lock
+static void *aligned_malloc(size_t alignment, size_t size)
+{
+    void *p = NULL;
+    size_t idx = my_aligned_class(alignment, size);
+    if (idx < CACHE_CLASS_COUNT && cached_class_malloc(idx, &p))
+        return count_malloc(p, idx, size);
+
+    hook_lock();
+    p = my_memalign(alignment, size);
+    hook_unlock();
+    return count_malloc(p, idx, size);
+}
+
+static int is_power_of_two(size_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+__attribute__((visibility("default"))) int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!is_power_of_two(alignment) || alignment % sizeof(void *) != 0)
+        return EINVAL;
+
+    void *p = aligned_malloc(alignment, size);
+    if (p == NULL && size != 0)
+        return ENOMEM;
+
+    *memptr = p;
+    return 0;
+}
+
+__attribute__((visibility("default"))) void *aligned_alloc(size_t alignment,
+                                                           size_t size)
+{
+    if (!is_power_of_two(alignment))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return aligned_malloc(alignment, size);
+}
+
+__attribute__((visibility("default"))) void *memalign(size_t alignment,
+                                                      size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+__attribute__((visibility("default"))) void *valloc(size_t size)
+{
+    return aligned_malloc(PAGE_SIZE, size);
+}
+
+__attribute__((visibility("default"))) void *pvalloc(size_t size)
+{
+    size_t ps = PAGE_SIZE;
+    if (ps == 0 || size > SIZE_MAX - (ps - 1))
+        return NULL;
+
+    return aligned_malloc(ps, (size + (ps - 1)) & ~(ps - 1));
+}
+
+__attribute__((visibility("default"))) size_t malloc_usable_size(void *ptr)
+{
+    return my_usable_size(ptr);
+}
+
+// One critical section for the whole batch. Blocks of a cached class come
+// straight from the spans and leave them owned by the thread cache, like a
+// refill.
+__attribute__((visibility("default"))) size_t
+tinymalloc_alloc_batch(size_t size, size_t n, void **ptrs)
+{
+    if (ptrs == NULL || n == 0)
+        return 0;
+
+    size_t idx = my_size_class(size);
+    uintptr_t owner = 0;
+    if (idx < CACHE_CLASS_COUNT && !percpu_available())
+        owner = (uintptr_t)thread_cache();
+
+    size_t count = 0;
+    hook_lock();
+    if (idx < BUCKET_COUNT)
+        count = my_malloc_batch(idx, ptrs, n, owner);
+    else
+        while (count < n && (ptrs[count] = my_malloc(size)) != NULL)
+            count++;
+    hook_unlock();
+
+    for (size_t i = 0; i < count; i++)
+        count_malloc(ptrs[i], idx, size);
+    return count;
+}
+
+// Sorted outside the lock, so that my_free_batch settles each page once
+__attribute__((visibility("default"))) void tinymalloc_free_batch(void **ptrs,
+                                                                  size_t n)
+{
+    if (ptrs == NULL)
+        return;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (ptrs[i] == NULL)
+            continue;
+
+        size_t idx = my_block_class(ptrs[i]);
+        if (idx == BUCKET_COUNT && my_usable_size(ptrs[i]) == 0)
+            ptrs[i] = NULL; // not a block of ours
+        else
+            count_free(ptrs[i], idx);
+    }
+    sort_pointers(ptrs, n);
+
+    hook_lock();
+    my_free_batch(ptrs, n);
+    hook_unlock();
+}
+
+__attribute__((visibility("default"))) struct tinymalloc_arena *
+tinymalloc_arena_create(size_t chunk_size)
+{
+    hook_lock();
+    struct region *r = region_create(chunk_size);
+    hook_unlock();
+    return (struct tinymalloc_arena *)r;
+}
+
+// Bumps without the lock, which is only taken to map a new chunk
+__attribute__((visibility("default"))) void *
+tinymalloc_arena_alloc(struct tinymalloc_arena *arena, size_t size)
+{
+    struct region *r = (struct region *)arena;
+    void *p = region_alloc(r, size);
+    if (__builtin_expect(p != NULL, 1))
+        return p;
+
+    hook_lock();
+    int grown = region_grow(r, size) == 0;
+    hook_unlock();
+    return grown ? region_alloc(r, size) : NULL;
+}
+
+__attribute__((visibility("default"))) struct tinymalloc_mark
+tinymalloc_arena_mark(struct tinymalloc_arena *arena)
+{
+    struct region_mark m = region_mark((struct region *)arena);
+    struct tinymalloc_mark mark = { m.chunk, m.top };
+    return mark;
+}
+
+__attribute__((visibility("default"))) void
+tinymalloc_arena_reset_to_mark(struct tinymalloc_arena *arena,
+                               struct tinymalloc_mark mark)
+{
+    struct region *r = (struct region *)arena;
+    struct region_mark m = { mark.chunk, mark.top };
+
+    // Within the newest chunk nothing is released, no lock is needed
+    if (r->chunks.meta == m.chunk)
+    {
+        region_reset(r, m);
+        return;
+    }
+
+    hook_lock();
+    region_reset(r, m);
+    hook_unlock();
+}
+
+__attribute__((visibility("default"))) void
+tinymalloc_arena_destroy(struct tinymalloc_arena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    hook_lock();
+    region_destroy((struct region *)arena);
+    hook_unlock();
+}
+
+__attribute__((visibility("default"))) void
+tinymalloc_lock_stats(struct tinymalloc_lock_stats *stats)
+{
+    if (stats == NULL)
+        return;
+
+    stats->acquisitions =
+        __atomic_load_n(&g_lock.acquisitions, __ATOMIC_RELAXED);
+    stats->contended = __atomic_load_n(&g_lock.contended, __ATOMIC_RELAXED);
+    stats->sleeps = __atomic_load_n(&g_lock.sleeps, __ATOMIC_RELAXED);
+    stats->wait_ns = __atomic_load_n(&g_lock.wait_ns, __ATOMIC_RELAXED);
+}
+
+__attribute__((visibility("default"))) size_t tinymalloc_class_count(void)
+{
+    return STATS_CLASS_COUNT;
+}
+
+// Must be called with the lock held, sum coming from stats_read
+static void class_stats(size_t index, const struct stats_counters *sum,
+                        struct tinymalloc_class_stats *stats)
+{
+    struct my_class_usage u;
+    my_class_usage(index, &u);
+
+    stats->block_size = my_class_size(index);
+    stats->spans = u.spans;
+    stats->mapped_bytes = u.bytes;
+    stats->blocks = u.blocks;
+    stats->capacity = u.capacity;
+    stats->mallocs = sum->mallocs[index];
+    stats->frees = sum->frees[index];
+    stats->live_blocks = stats->mallocs - stats->frees;
+    stats->requested_bytes = sum->requested[index];
+    stats->allocated_bytes = sum->allocated[index];
+}
+
+__attribute__((visibility("default"))) int
+tinymalloc_class_stats(size_t index, struct tinymalloc_class_stats *stats)
+{
+    if (stats == NULL || index >= STATS_CLASS_COUNT)
+        return -1;
+
+    struct stats_counters sum;
+    hook_lock();
+    stats_read(&sum);
+    class_stats(index, &sum, stats);
+    hook_unlock();
+    return 0;
+}
+
+// Must be called with the lock held. Live bytes of the classes come from the
+// front-end counters, large blocks are exactly those still mapped.
+static void heap_stats(const struct stats_counters *sum,
+                       struct tinymalloc_stats *stats)
+{
+    struct my_heap_usage h;
+    my_heap_usage(&h);
+
+    stats->mapped_bytes = 0;
+    stats->live_bytes = 0;
+    stats->pooled_bytes = h.pooled_bytes;
+    stats->meta_bytes = h.meta_bytes;
+    stats->region_bytes = h.region_bytes;
+    stats->maps = h.maps;
+    stats->unmaps = h.unmaps;
+
+    for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+    {
+        struct tinymalloc_class_stats c;
+        class_stats(i, sum, &c);
+        stats->mapped_bytes += c.mapped_bytes;
+        if (i < BUCKET_COUNT)
+            stats->live_bytes += c.live_blocks * c.block_size;
+    }
+
+    struct my_class_usage large;
+    my_class_usage(BUCKET_COUNT, &large);
+    stats->live_bytes += large.block_bytes;
+}
+
+__attribute__((visibility("default"))) void
+tinymalloc_stats(struct tinymalloc_stats *stats)
+{
+    if (stats == NULL)
+        return;
+
+    struct stats_counters sum;
+    hook_lock();
+    stats_read(&sum);
+    heap_stats(&sum, stats);
+    hook_unlock();
+}
+
+// The calling thread's cache is emptied now, the others on their next slow
+// path
+__attribute__((visibility("default"))) size_t tinymalloc_trim(void)
+{
+    hook_lock();
+    budget_flush_caches();
+    if (g_tcache_state == TCACHE_ACTIVE)
+        tcache_follow_budget(&g_tcache);
+    size_t released = my_trim();
+    hook_unlock();
+    return released;
+}
+
+__attribute__((visibility("default"))) void
+tinymalloc_set_mem_limit(size_t bytes)
+{
+    hook_lock();
+    conf.mem_limit = bytes;
+    hook_unlock();
+}
+
+__attribute__((visibility("default"))) int malloc_trim(size_t pad)
+{
+    (void)pad;
+    return tinymalloc_trim() != 0;
+}
+
+// Must be called with the lock held. Free blocks of the caches: what the
+// cached classes carved that the program does not hold.
+static size_t cached_bytes(void)
+{
+    struct stats_counters sum;
+    stats_read(&sum);
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < CACHE_CLASS_COUNT; i++)
+    {
+        struct my_class_usage u;
+        my_class_usage(i, &u);
+        uint64_t live = (sum.mallocs[i] - sum.frees[i]) * my_class_size(i);
+        if (u.block_bytes > live)
+            bytes += u.block_bytes - live;
+    }
+    return bytes;
+}
+
+// Runs on the PSI monitor thread, which has no cache of its own
+static void trim_on_pressure(void)
+{
+    tinymalloc_trim();
+}
+
+#if defined(__GLIBC__)                                                         \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+__attribute__((visibility("default"))) struct mallinfo2 mallinfo2(void)
+{
+    struct mallinfo2 mi;
+    memset(&mi, 0, sizeof(mi));
+
+    struct stats_counters sum;
+    struct tinymalloc_stats total;
+    struct my_class_usage large;
+    hook_lock();
+    stats_read(&sum);
+    heap_stats(&sum, &total);
+    my_class_usage(BUCKET_COUNT, &large);
+    hook_unlock();
+
+    // Spans, their headers and the arena chunks play the part of the main
+    // arena, large mappings of mmapped chunks. Arena chunks count as in use.
+    mi.arena = total.mapped_bytes - large.bytes + total.pooled_bytes
+        + total.meta_bytes + total.region_bytes;
+    mi.hblks = large.spans;
+    mi.hblkhd = large.bytes;
+    mi.uordblks = total.live_bytes - large.block_bytes + total.region_bytes;
+    mi.fordblks = mi.arena - mi.uordblks;
+    mi.keepcost = total.pooled_bytes;
+    return mi;
+}
+#endif
+
+// snprintf does not allocate for integer conversions
+static void print_line(int fd, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void print_line(int fd, const char *fmt, ...)
+{
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (n <= 0)
+        return;
+    size_t len = (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+    if (write(fd, line, len) < 0)
+        return;
+}
+
+__attribute__((visibility("default"))) void malloc_stats(void)
+{
+    struct stats_counters sum;
+    struct tinymalloc_stats total;
+    struct tinymalloc_class_stats classes[STATS_CLASS_COUNT];
+
+    hook_lock();
+    stats_read(&sum);
+    heap_stats(&sum, &total);
+    for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+        class_stats(i, &sum, &classes[i]);
+    hook_unlock();
+
+    print_line(STDERR_FILENO,
+               "tinymalloc: mapped %llu kB, pooled %llu kB, meta %llu kB, "
+               "arenas %llu kB, live %llu kB, mmap %llu, munmap %llu\n",
+               (unsigned long long)total.mapped_bytes / 1024,
+               (unsigned long long)total.pooled_bytes / 1024,
+               (unsigned long long)total.meta_bytes / 1024,
+               (unsigned long long)total.region_bytes / 1024,
+               (unsigned long long)total.live_bytes / 1024,
+               (unsigned long long)total.maps,
+               (unsigned long long)total.unmaps);
+    print_line(STDERR_FILENO, "%8s %6s %10s %9s %9s %9s %10s %10s %12s %12s\n",
+               "class", "spans", "mapped_kB", "blocks", "capacity", "live",
+               "mallocs", "frees", "requested", "allocated");
+
+    for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+    {
+        const struct tinymalloc_class_stats *c = &classes[i];
+        if (c->spans == 0 && c->mallocs == 0)
+            continue;
+
+        char name[16];
+        if (i < BUCKET_COUNT)
+            snprintf(name, sizeof(name), "%llu",
+                     (unsigned long long)c->block_size);
+        else
+            snprintf(name, sizeof(name), "large");
+
+        print_line(STDERR_FILENO,
+                   "%8s %6llu %10llu %9llu %9llu %9llu %10llu %10llu %12llu "
+                   "%12llu\n",
+                   name, (unsigned long long)c->spans,
+                   (unsigned long long)c->mapped_bytes / 1024,
+                   (unsigned long long)c->blocks,
+                   (unsigned long long)c->capacity,
+                   (unsigned long long)c->live_blocks,
+                   (unsigned long long)c->mallocs,
+                   (unsigned long long)c->frees,
+                   (unsigned long long)c->requested_bytes,
+                   (unsigned long long)c->allocated_bytes);
+    }
+}
+
+// TINYMALLOC_PROF_RATE turns the heap profiler on, see my_profile.h
+__attribute__((constructor)) static void profile_at_start(void)
+{
+    conf_init();
+    profile_init();
+    budget_init(trim_on_pressure, cached_bytes);
+}
+
+// TINYMALLOC_STATS set to anything but 0, or stats:1 in TINYMALLOC_CONF,
+// dumps the statistics at exit, a running profiler dumps its last profile
+__attribute__((destructor)) static void stats_at_exit(void)
+{
+    const char *env = getenv("TINYMALLOC_STATS");
+    if (conf.stats || (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0))
+        malloc_stats();
+    if (profile_active)
+        profile_dump_next();
 }
@@ -0,0 +1,174 @@
+#include "my_budget.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define PRESSURE_FILE "/memory.pressure"
+
+// The monitor only waits on a file descriptor
+#define MONITOR_STACK_SIZE (64 * 1024)
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#    define BUDGET_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#    define BUDGET_CLOCK CLOCK_MONOTONIC
+#endif
+
+unsigned budget_epoch;
+
+static void (*pressure_cb)(void);
+static size_t (*cached_bytes_cb)(void);
+
+// Time of the last flush asked for by the soft limit, under the lock
+static uint64_t last_flush_ms;
+static int flushed;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    if (clock_gettime(BUDGET_CLOCK, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+void budget_flush_over_limit(void)
+{
+    uint64_t now = now_ms();
+    if (flushed && now - last_flush_ms < BUDGET_FLUSH_MS)
+        return;
+
+    // Checked second, the estimate walks every thread's counters
+    if (cached_bytes_cb != NULL && cached_bytes_cb() < BUDGET_FLUSH_MIN_BYTES)
+        return;
+
+    flushed = 1;
+    last_flush_ms = now;
+    budget_flush_caches();
+}
+
+// Opens the memory.pressure file of the cgroup v2 the process is in, found
+// through the "0::<path>" line of /proc/self/cgroup, without allocating
+static int open_cgroup_pressure(void)
+{
+    char buf[512];
+    int fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+
+    char *line = buf;
+    while (line != NULL && strncmp(line, "0::", 3) != 0)
+    {
+        line = strchr(line, '\n');
+        if (line != NULL)
+            line++;
+    }
+    if (line == NULL)
+        return -1;
+
+    char *cg = line + 3;
+    char *eol = strchr(cg, '\n');
+    if (eol != NULL)
+        *eol = '\0';
+
+    char path[sizeof(CGROUP_ROOT) + sizeof(buf) + sizeof(PRESSURE_FILE)];
+    strcpy(path, CGROUP_ROOT);
+    strcat(path, strcmp(cg, "/") == 0 ? "" : cg);
+    strcat(path, PRESSURE_FILE);
+    return open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+}
+
+// Registers the trigger, the file then polls with POLLPRI when it fires
+static int open_pressure(const char *trigger)
+{
+    int fd = open_cgroup_pressure();
+    if (fd < 0)
+        fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    size_t len = strlen(trigger) + 1;
+    if (write(fd, trigger, len) != (ssize_t)len)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *monitor(void *arg)
+{
+    struct pollfd pfd;
+    pfd.fd = (int)(intptr_t)arg;
+    pfd.events = POLLPRI;
+
+    for (;;)
+    {
+        int n = poll(&pfd, 1, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || (pfd.revents & (POLLERR | POLLNVAL)))
+            break;
+        if (pfd.revents & POLLPRI)
+            pressure_cb();
+    }
+
+    close(pfd.fd);
+    return NULL;
+}
+
+// Best effort: without PSI the soft limit is all there is
+static void start_monitor(const char *trigger)
+{
+    int fd = open_pressure(trigger);
+    if (fd < 0)
+        return;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, MONITOR_STACK_SIZE);
+
+    // The monitor must not take the signals meant for the program
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, monitor, (void *)(intptr_t)fd) != 0)
+        close(fd);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+void budget_init(void (*on_pressure)(void), size_t (*cached_bytes)(void))
+{
+    cached_bytes_cb = cached_bytes;
+
+    // TINYMALLOC_PSI=1 uses the default trigger, a "some ..." or
+    // "full ..." line replaces it
+    const char *env = getenv("TINYMALLOC_PSI");
+    if (env == NULL || env[0] == '\0' || strcmp(env, "0") == 0)
+        return;
+
+    pressure_cb = on_pressure;
+    if (strncmp(env, "some ", 5) == 0 || strncmp(env, "full ", 5) == 0)
+        start_monitor(env);
+    else
+        start_monitor(BUDGET_PSI_TRIGGER);
+}
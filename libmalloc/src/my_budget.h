@@ -0,0 +1,70 @@
+#ifndef MY_BUDGET_H
+#define MY_BUDGET_H
+
+#include <stddef.h>
+
+/**
+ * @brief Stall that fires the PSI trigger: 150 ms of some tasks waiting on
+ * memory within a 2 s window, the finest window an unprivileged process may
+ * ask for.
+ */
+#define BUDGET_PSI_TRIGGER "some 150000 2000000"
+
+/**
+ * @brief Shortest time between two flushes asked for by the soft limit, in
+ * milliseconds. A heap that stays over the limit would otherwise empty the
+ * caches on every span it maps or releases.
+ */
+#ifndef BUDGET_FLUSH_MS
+#    define BUDGET_FLUSH_MS 100
+#endif
+
+/**
+ * @brief Fewest bytes of free blocks the caches must hold for the soft limit
+ * to ask them to flush.
+ */
+#ifndef BUDGET_FLUSH_MIN_BYTES
+#    define BUDGET_FLUSH_MIN_BYTES (256 * 1024)
+#endif
+
+/**
+ * @brief Bumped every time the thread caches should be flushed. Each thread
+ * compares it with the value it last saw on its next slow path.
+ */
+extern unsigned budget_epoch;
+
+/**
+ * @brief Asks every thread cache to flush on its next slow path.
+ *
+ * Lock-free and safe to call from any thread.
+ */
+static inline void budget_flush_caches(void)
+{
+    __atomic_add_fetch(&budget_epoch, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Asks every thread cache to flush on behalf of the soft limit, unless
+ * it did less than BUDGET_FLUSH_MS ago or the caches hold less than
+ * BUDGET_FLUSH_MIN_BYTES.
+ *
+ * Must be called with the allocator lock held.
+ */
+void budget_flush_over_limit(void);
+
+/**
+ * @brief Reads TINYMALLOC_PSI and starts the pressure monitor if it is set.
+ *
+ * The monitor is a thread blocked on the memory.pressure file of the
+ * process's cgroup, or on /proc/pressure/memory outside of a cgroup v2. It
+ * calls on_pressure every time the trigger fires. Meant to run once from the
+ * library constructor.
+ *
+ * @param on_pressure Called from the monitor thread, without any lock held.
+ * @param cached_bytes Called with the allocator lock held, returns the bytes
+ * of free blocks the caches hold. Until it is set they are assumed to hold
+ * enough to be worth a flush.
+ */
+void budget_init(void (*on_pressure)(void), size_t (*cached_bytes)(void));
+
+#endif /* !MY_BUDGET_H */
@@ -0,0 +1,216 @@
+#include "my_conf.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "my_malloc.h"
+#include "my_tcache.h"
+#include "page_pool.h"
+
+#ifdef MY_HUGE_PAGES
+#    define CONF_HUGE_PAGES 1
+#else
+#    define CONF_HUGE_PAGES 0
+#endif
+
+// Smallest large threshold: the classes the caches serve stay classes
+#define CONF_MIN_LARGE 4096
+
+struct my_conf conf = {
+    .large_threshold = LARGE_THRESHOLD,
+    .span_max_pages = SPAN_MAX_PAGES,
+    .span_waste_div = SPAN_WASTE_DIV,
+    .tcache_bytes = TCACHE_BIN_BYTES,
+    .tcache_max = TCACHE_MAX_COUNT,
+    .tcache_min = TCACHE_MIN_COUNT,
+    .purge_ms = POOL_PURGE_MS,
+    .unmap_ms = POOL_UNMAP_MS,
+    .pool_bytes = POOL_MAX_BYTES,
+    .pool_large_bytes = POOL_LARGE_MAX_BYTES,
+    .pool_large_max = POOL_LARGE_MAX_SIZE,
+    .mem_limit = 0,
+    .huge_pages = CONF_HUGE_PAGES,
+    .stats = 0,
+};
+
+/**
+ * @brief A key of TINYMALLOC_CONF and the range of its values.
+ */
+struct conf_key
+{
+    const char *name; ///< Key as written in the string.
+    size_t offset; ///< Offset of its field in struct my_conf.
+    size_t min; ///< Smallest value accepted.
+    size_t max; ///< Largest value accepted.
+};
+
+#define CONF_KEY(field, min, max)                                              \
+    {                                                                          \
+        #field, offsetof(struct my_conf, field), min, max                      \
+    }
+
+static const struct conf_key keys[] = {
+    CONF_KEY(large_threshold, CONF_MIN_LARGE, MAX_BUCKET_SIZE),
+    CONF_KEY(span_max_pages, 1, SPAN_MAX_PAGES),
+    CONF_KEY(span_waste_div, 1, SIZE_MAX),
+    CONF_KEY(tcache_bytes, 0, SIZE_MAX),
+    CONF_KEY(tcache_max, 2, TCACHE_MAX_COUNT),
+    CONF_KEY(tcache_min, 2, TCACHE_MAX_COUNT),
+    CONF_KEY(purge_ms, 0, SIZE_MAX),
+    CONF_KEY(unmap_ms, 0, SIZE_MAX),
+    CONF_KEY(pool_bytes, 0, SIZE_MAX),
+    CONF_KEY(pool_large_bytes, 0, SIZE_MAX),
+    CONF_KEY(pool_large_max, 0, SIZE_MAX),
+    CONF_KEY(mem_limit, 0, SIZE_MAX),
+    CONF_KEY(huge_pages, 0, 1),
+    CONF_KEY(stats, 0, 1),
+};
+
+// 0 untouched, 1 being parsed, 2 parsed
+static int conf_state;
+
+int conf_parse_size(const char *s, size_t len, size_t *out)
+{
+    size_t i = 0;
+    size_t n = 0;
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++)
+    {
+        size_t digit = (size_t)(s[i] - '0');
+        if (n > (SIZE_MAX - digit) / 10)
+            return -1;
+        n = n * 10 + digit;
+    }
+    if (i == 0)
+        return -1;
+
+    unsigned shift = 0;
+    if (i + 1 == len)
+    {
+        switch (s[i])
+        {
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        default:
+            return -1;
+        }
+    }
+    else if (i != len)
+        return -1;
+
+    if (n > (SIZE_MAX >> shift))
+        return -1;
+    *out = n << shift;
+    return 0;
+}
+
+static int apply_pair(struct my_conf *c, const char *pair, size_t len)
+{
+    const char *colon = memchr(pair, ':', len);
+    if (colon == NULL)
+        return -1;
+
+    size_t key_len = (size_t)(colon - pair);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    {
+        const struct conf_key *k = &keys[i];
+        if (strlen(k->name) != key_len || memcmp(k->name, pair, key_len) != 0)
+            continue;
+
+        size_t value;
+        if (conf_parse_size(colon + 1, len - key_len - 1, &value) != 0
+            || value < k->min || value > k->max)
+            return -1;
+
+        *(size_t *)((char *)c + k->offset) = value;
+        return 0;
+    }
+    return -1;
+}
+
+static void report(const char *pair, size_t len)
+{
+    static const char head[] = "tinymalloc: skipping TINYMALLOC_CONF entry \"";
+    static const char tail[] = "\"\n";
+    if (write(STDERR_FILENO, head, sizeof(head) - 1) < 0
+        || write(STDERR_FILENO, pair, len) < 0
+        || write(STDERR_FILENO, tail, sizeof(tail) - 1) < 0)
+        return;
+}
+
+static void report_tcache_bounds(void)
+{
+    static const char msg[] =
+        "tinymalloc: tcache_min is above tcache_max, lowering it\n";
+    if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0)
+        return;
+}
+
+size_t conf_parse(struct my_conf *c, const char *s)
+{
+    size_t skipped = 0;
+    while (*s != '\0')
+    {
+        size_t len = strcspn(s, ",");
+        if (len != 0 && apply_pair(c, s, len) != 0)
+        {
+            report(s, len);
+            skipped++;
+        }
+
+        s += len;
+        if (*s == ',')
+            s++;
+    }
+
+    // Each bound is checked alone above, a minimum over the maximum would
+    // make the caches ignore tcache_max
+    if (c->tcache_min > c->tcache_max)
+    {
+        report_tcache_bounds();
+        c->tcache_min = c->tcache_max;
+    }
+    return skipped;
+}
+
+void conf_read_env(struct my_conf *c)
+{
+    // TINYMALLOC_MEM_LIMIT stays as a shorthand, TINYMALLOC_CONF wins
+    const char *env = getenv("TINYMALLOC_MEM_LIMIT");
+    if (env != NULL)
+        conf_parse_size(env, strlen(env), &c->mem_limit);
+
+    env = getenv("TINYMALLOC_CONF");
+    if (env != NULL)
+        conf_parse(c, env);
+}
+
+void conf_init(void)
+{
+    if (__atomic_load_n(&conf_state, __ATOMIC_ACQUIRE) == 2)
+        return;
+
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&conf_state, &expected, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        // Parsing a few bytes of environment, not worth sleeping for
+        while (__atomic_load_n(&conf_state, __ATOMIC_ACQUIRE) != 2)
+            ;
+        return;
+    }
+
+    conf_read_env(&conf);
+    __atomic_store_n(&conf_state, 2, __ATOMIC_RELEASE);
+}
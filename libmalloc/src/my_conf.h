@@ -0,0 +1,78 @@
+#ifndef MY_CONF_H
+#define MY_CONF_H
+
+#include <stddef.h>
+
+/**
+ * @brief Tuning read from TINYMALLOC_CONF, a list of key:value pairs
+ * separated by commas such as "large_threshold:64k,purge_ms:0". Sizes take an
+ * optional k, m or g suffix.
+ *
+ * Every field starts at its compile-time default, so the struct is valid
+ * before the string is parsed. Written once by conf_init, then only read,
+ * except for mem_limit which tinymalloc_set_mem_limit updates.
+ */
+struct my_conf
+{
+    size_t large_threshold; ///< Requests above it get a mapping of their own,
+                            ///< from 4 KiB to MAX_BUCKET_SIZE.
+    size_t span_max_pages; ///< Longest span, up to SPAN_MAX_PAGES.
+    size_t span_waste_div; ///< Spans grow until at most 1 / span_waste_div
+                           ///< of them is lost.
+    size_t tcache_bytes; ///< Byte budget of a thread cache bin.
+    size_t tcache_max; ///< Most blocks a bin holds, 2 to TCACHE_MAX_COUNT.
+    size_t tcache_min; ///< Fewest blocks a bin holds, 2 to tcache_max.
+    size_t purge_ms; ///< Age at which pooled spans are purged.
+    size_t unmap_ms; ///< Age at which pooled spans are unmapped, 0 to keep
+                     ///< none.
+    size_t pool_bytes; ///< Bytes of spans pooled per NUMA node.
+    size_t pool_large_bytes; ///< Bytes of large mappings pooled per node.
+    size_t pool_large_max; ///< Longest large mapping pooled.
+    size_t mem_limit; ///< Soft limit on the mapped bytes, 0 for none.
+    size_t huge_pages; ///< 1 to back mappings with 2 MiB pages.
+    size_t stats; ///< 1 to print the statistics at exit.
+};
+
+/**
+ * @brief The configuration in use.
+ */
+extern struct my_conf conf;
+
+/**
+ * @brief Parses a size in bytes, with an optional k, m or g suffix.
+ *
+ * @param s The string.
+ * @param len Its length.
+ * @param out Receives the size.
+ * @return 0 on success, -1 if the string is not a size.
+ */
+int conf_parse_size(const char *s, size_t len, size_t *out);
+
+/**
+ * @brief Applies a TINYMALLOC_CONF string to a configuration, without
+ * allocating.
+ *
+ * Unknown keys and out-of-range values are reported on stderr and skipped.
+ * A tcache_min above tcache_max is reported and lowered to it.
+ *
+ * @param c The configuration to update.
+ * @param s The string.
+ * @return The number of pairs skipped.
+ */
+size_t conf_parse(struct my_conf *c, const char *s);
+
+/**
+ * @brief Applies TINYMALLOC_MEM_LIMIT, then TINYMALLOC_CONF, to a
+ * configuration. A mem_limit in TINYMALLOC_CONF wins over the shorthand.
+ *
+ * @param c The configuration to update.
+ */
+void conf_read_env(struct my_conf *c);
+
+/**
+ * @brief Parses TINYMALLOC_CONF into conf on first call, later calls return
+ * at once. Threads racing on the first call wait for it.
+ */
+void conf_init(void);
+
+#endif /* !MY_CONF_H */
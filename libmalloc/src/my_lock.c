@@ -0,0 +1,72 @@
+#include "my_lock.h"
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline void cpu_relax(void) { __asm__ __volatile__("pause" ::: "memory"); }
+#else
+static inline void cpu_relax(void) { /* no-op */ }
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void futex_wait(atomic_int *addr, int val)
+{
+    // Returns early on EAGAIN (value changed) or EINTR, callers re-check
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void lock_acquire_slow(struct my_lock *lock)
+{
+    uint64_t start = now_ns();
+    uint64_t sleeps = 0;
+
+    // Spin while the owner is likely running and about to release
+    for (unsigned i = 0; i < LOCK_SPIN_COUNT; i++)
+    {
+        int expected = LOCK_FREE;
+        if (atomic_load_explicit(&lock->state, memory_order_relaxed)
+                == LOCK_FREE
+            && atomic_compare_exchange_weak_explicit(
+                &lock->state, &expected, LOCK_HELD, memory_order_acquire,
+                memory_order_relaxed))
+            goto acquired;
+        cpu_relax();
+    }
+
+    // Mark the lock contended so the owner wakes us, then park. Taking the
+    // lock in the contended state may cost a spurious wake, never a lost one.
+    while (atomic_exchange_explicit(&lock->state, LOCK_CONTENDED,
+                                    memory_order_acquire)
+           != LOCK_FREE)
+    {
+        futex_wait(&lock->state, LOCK_CONTENDED);
+        sleeps++;
+    }
+
+acquired:
+    lock->acquisitions++;
+    lock->contended++;
+    lock->sleeps += sleeps;
+    lock->wait_ns += now_ns() - start;
+}
+
+void lock_release_slow(struct my_lock *lock)
+{
+    futex_wake(&lock->state);
+}
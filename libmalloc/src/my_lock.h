@@ -0,0 +1,89 @@
+#ifndef MY_LOCK_H
+#define MY_LOCK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of polls of a held lock before the waiter parks on the futex.
+ */
+#define LOCK_SPIN_COUNT 128
+
+/**
+ * @brief States of a lock word.
+ */
+enum lock_state
+{
+    LOCK_FREE = 0, ///< Not held.
+    LOCK_HELD = 1, ///< Held, nobody sleeping on it.
+    LOCK_CONTENDED = 2, ///< Held, waiters may be parked on the futex.
+};
+
+/**
+ * @brief Adaptive, non-allocating lock: spins briefly, then parks the thread
+ * on a futex so a preempted owner does not make waiters burn their timeslice.
+ *
+ * The counters are only written by the lock owner, so they need no atomic
+ * operation and can be read racily for statistics.
+ */
+struct my_lock
+{
+    atomic_int state; ///< One of enum lock_state.
+    uint64_t acquisitions; ///< Number of times the lock was taken.
+    uint64_t contended; ///< Acquisitions that found the lock held.
+    uint64_t sleeps; ///< Number of times a waiter parked on the futex.
+    uint64_t wait_ns; ///< Time spent waiting by contended acquisitions.
+};
+
+#define MY_LOCK_INIT                                                           \
+    {                                                                          \
+        LOCK_FREE, 0, 0, 0, 0                                                  \
+    }
+
+/**
+ * @brief Slow path of lock_acquire, spins then sleeps until the lock is free.
+ *
+ * @param lock Pointer to the lock.
+ */
+void lock_acquire_slow(struct my_lock *lock);
+
+/**
+ * @brief Slow path of lock_release, wakes one parked waiter.
+ *
+ * @param lock Pointer to the lock.
+ */
+void lock_release_slow(struct my_lock *lock);
+
+/**
+ * @brief Takes the lock, blocking if it is held. Not recursive.
+ *
+ * @param lock Pointer to the lock.
+ */
+static inline void lock_acquire(struct my_lock *lock)
+{
+    int expected = LOCK_FREE;
+    if (__builtin_expect(atomic_compare_exchange_strong_explicit(
+                             &lock->state, &expected, LOCK_HELD,
+                             memory_order_acquire, memory_order_relaxed),
+                         1))
+    {
+        lock->acquisitions++;
+        return;
+    }
+
+    lock_acquire_slow(lock);
+}
+
+/**
+ * @brief Releases the lock and wakes a waiter if one may be parked.
+ *
+ * @param lock Pointer to the lock.
+ */
+static inline void lock_release(struct my_lock *lock)
+{
+    if (atomic_exchange_explicit(&lock->state, LOCK_FREE, memory_order_release)
+        == LOCK_CONTENDED)
+        lock_release_slow(lock);
+}
+
+#endif /* !MY_LOCK_H */
@@ -3,16 +3,28 @@
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/mman.h>
 
 #include "blk_allocator.h"
+#include "my_budget.h"
+#include "my_conf.h"
+#include "my_numa.h"
+#include "my_region.h"
 #include "my_recycler.h"
+#include "page_map.h"
+#include "page_meta.h"
+#include "page_pool.h"
 #include "tools.h"
 
-#define MIN_BLOCK_SIZE 16
-#define MAX_BUCKET_SIZE 1024
-#define BUCKET_COUNT 7
+// An arena of buckets per NUMA node, the thread allocating picks the one of
+// the node it runs on. Only the first is used on a single node.
+static struct blk_allocator arenas[NUMA_MAX_NODES][BUCKET_COUNT + 1];
 
-static struct blk_allocator buckets[BUCKET_COUNT + 1];
+// Pages whose remote free list needs collecting, linked through remote_next
+static struct recycler *remote_pages;
+
+// Spans and blocks held by each class, updated under the lock
+static struct my_class_usage usage[BUCKET_COUNT + 1];
 
 static void add_block_to_list(struct blk_allocator *alloc, struct blk_meta *block)
 {
@@ -37,79 +49,411 @@ static void remove_block_from_list(struct blk_allocator *alloc, struct blk_meta
     block->prev = NULL;
 }
 
+// Block size of each class: 16-byte steps up to 64, then four steps per
+// power of two up to MAX_BUCKET_SIZE
+static const size_t class_sizes[BUCKET_COUNT] = {
+#ifdef MY_TINY_CLASS
+    8,
+#endif
+    16,     32,     48,     64,     80,     96,     112,    128,
+    160,    192,    224,    256,    320,    384,    448,    512,
+    640,    768,    896,    1024,   1280,   1536,   1792,   2048,
+    2560,   3072,   3584,   4096,   5120,   6144,   7168,   8192,
+    10240,  12288,  14336,  16384,  20480,  24576,  28672,  32768,
+    40960,  49152,  57344,  65536,  81920,  98304,  114688, 131072,
+    163840, 196608, 229376, 262144,
+};
+
+// Smallest class holding a size, indexed by the size rounded up to 8 bytes
+// for small classes and to 256 bytes (the finest medium step) above
+static uint8_t class_by_8[SMALL_MAX_SIZE / 8 + 1];
+static uint8_t class_by_256[MAX_BUCKET_SIZE / 256 + 1];
+static int classes_ready;
+
+// Racing threads write the same bytes, so it may run without the lock. The
+// first allocation also parses the configuration.
+static void init_class_tables(void)
+{
+    conf_init();
+
+    size_t c = 0;
+    for (size_t i = 0; i < sizeof(class_by_8); i++)
+    {
+        while (class_sizes[c] < i * 8)
+            c++;
+        class_by_8[i] = (uint8_t)c;
+    }
+
+    c = 0;
+    for (size_t i = 0; i < sizeof(class_by_256); i++)
+    {
+        while (class_sizes[c] < i * 256)
+            c++;
+        class_by_256[i] = (uint8_t)c;
+    }
+
+    __atomic_store_n(&classes_ready, 1, __ATOMIC_RELEASE);
+}
+
 static size_t get_bucket_index(size_t size)
 {
-    if (size > MAX_BUCKET_SIZE)
-        return BUCKET_COUNT;
+    if (__builtin_expect(!__atomic_load_n(&classes_ready, __ATOMIC_ACQUIRE),
+                         0))
+        init_class_tables();
 
-    if (size <= MIN_BLOCK_SIZE)
-        return 0;
+    if (size > conf.large_threshold)
+        return BUCKET_COUNT;
 
-    // size assumed aligned to 16
-    return (sizeof(size_t) * 8) - (size_t)__builtin_clzl(size - 1) - 4;
+    if (size <= SMALL_MAX_SIZE)
+        return class_by_8[(size + 7) >> 3];
+    return class_by_256[(size + 255) >> 8];
 }
 
 static size_t get_size_for_index(size_t index)
 {
     if (index >= BUCKET_COUNT)
         return 0;
-    return (size_t)16 << index;
+    return class_sizes[index];
 }
 
-static struct blk_meta *new_page(struct blk_allocator *alloc, size_t block_size)
+// Picks the smallest span whose tail stays under 1 / span_waste_div of it, or
+// the least wasteful one if no span up to span_max_pages does. Computed once
+// per class, under the lock.
+static size_t span_size(size_t index, size_t block_size)
 {
-    struct blk_meta *m = blka_alloc(alloc, block_size);
-    if (m == NULL)
-        return NULL;
+    static size_t spans[BUCKET_COUNT];
+    if (spans[index] != 0)
+        return spans[index];
 
-    struct recycler *r = (struct recycler *)(m + 1);
+    size_t ps = tools_page_size();
+    size_t best = 0;
+    size_t best_waste = 0;
+
+    // Whatever the configured bound, a span holds at least one block
+    size_t max_pages = conf.span_max_pages;
+    if (max_pages < (block_size + ps - 1) / ps)
+        max_pages = (block_size + ps - 1) / ps;
 
-    // Offset from mapping base to first allocatable block start
-    size_t offset = size_align(sizeof(struct blk_meta) + sizeof(struct recycler));
-    if (offset == 0)
+    // With no header in the span, a class whose size is a multiple of the
+    // page would otherwise get a span per block
+    size_t min_len = max_pages * ps;
+    if (block_size <= min_len / SPAN_MIN_BLOCKS)
+        min_len = block_size * SPAN_MIN_BLOCKS;
+
+    for (size_t n = 1; n <= max_pages; n++)
     {
-        blka_remove(alloc, m);
-        return NULL;
+        size_t len = n * ps;
+        if (len < min_len)
+            continue;
+
+        size_t blocks = len / block_size;
+        if (blocks > RECYCLER_MAX_BLOCKS)
+            blocks = RECYCLER_MAX_BLOCKS;
+
+        size_t waste = len - blocks * block_size;
+        if (waste <= len / conf.span_waste_div)
+        {
+            best = len;
+            break;
+        }
+
+        if (best == 0 || waste * best < best_waste * len)
+        {
+            best = len;
+            best_waste = waste;
+        }
     }
 
-    size_t map_len = m->size + sizeof(struct blk_meta);
+    spans[index] = best;
+    return best;
+}
+
+// Bytes of a mapping registered in the page map. Blocks of a span may sit on
+// any of its pages, a large block is only looked up by its start.
+static size_t mapped_extent(struct blk_meta *m)
+{
+    struct recycler *r = (struct recycler *)(m + 1);
+    if (r->class_index < BUCKET_COUNT)
+        return m->size;
+    return 1;
+}
+
+static void count_blocks(const struct recycler *r, size_t n)
+{
+    usage[r->class_index].blocks += n;
+    usage[r->class_index].block_bytes += n * r->block_size;
+}
+
+static void uncount_blocks(const struct recycler *r, size_t n)
+{
+    usage[r->class_index].blocks -= n;
+    usage[r->class_index].block_bytes -= n * r->block_size;
+}
+
+// Bytes mapped for the classes, their headers, the arenas and the page pool
+static size_t heap_bytes(void)
+{
+    size_t bytes = pool_bytes() + meta_bytes() + region_bytes();
+    for (size_t i = 0; i <= BUCKET_COUNT; i++)
+        bytes += usage[i].bytes;
+    return bytes;
+}
 
-    // Ensure first block and at least one full block fits in mapping
-    if (map_len <= offset || (map_len - offset) < block_size)
+void my_enforce_budget(size_t extra)
+{
+    if (conf.mem_limit == 0 || heap_bytes() + extra <= conf.mem_limit)
+        return;
+
+    pool_release();
+    budget_flush_over_limit();
+}
+
+// Empty spans and large mappings go to the page pool for any class or large
+// block to reuse
+static void release_page(struct blk_allocator *alloc, struct blk_meta *m)
+{
+    struct recycler *r = (struct recycler *)(m + 1);
+    struct my_class_usage *u = &usage[r->class_index];
+    u->spans--;
+    u->bytes -= m->size;
+    u->capacity -= r->capacity;
+
+    pagemap_clear(r->chunk, mapped_extent(m));
+    remove_block_from_list(alloc, m);
+    void *map = r->chunk;
+    size_t len = m->size;
+    size_t node = r->node;
+    meta_free(m);
+    pool_put(map, len, node);
+    my_enforce_budget(0);
+}
+
+// Puts a page whose free list just grew back in shape: relists it if it was
+// full, and unmaps it once nothing is allocated from it. A page still waiting
+// for the collector is left to my_remote_collect.
+static void settle_page(struct blk_meta *m, int was_full)
+{
+    struct recycler *r = (struct recycler *)(m + 1);
+    struct blk_allocator *alloc = &arenas[r->node][r->class_index];
+
+    if (was_full && !recycler_full(r))
+        add_block_to_list(alloc, m);
+
+    if (r->allocated == 0
+        && !(__atomic_load_n(&r->remote, __ATOMIC_ACQUIRE) & REMOTE_PENDING))
+        release_page(alloc, m);
+}
+
+// Maps a span for a size class, or a mapping of its own for a large block
+// aligned to align when index is BUCKET_COUNT, with its pages on a node. The
+// header is kept apart, so blocks start at the first byte of the mapping.
+static struct blk_meta *new_page(size_t node, size_t index,
+                                 size_t block_size, size_t align)
+{
+    size_t ps = tools_page_size();
+    if (ps == 0)
+        return NULL;
+
+    size_t len = 0;
+    if (index < BUCKET_COUNT)
+        len = blka_map_size(span_size(index, block_size));
+    else
+        len = blka_map_size(block_size);
+    if (len == 0)
+        return NULL;
+
+    struct blk_meta *m = meta_alloc();
+    if (m == NULL)
+        return NULL;
+
+    // Pooled mappings are only page aligned, and already on the node
+    void *map = NULL;
+    size_t zero = 0;
+    if (align <= ps)
+        map = pool_take(&len, &zero, node);
+
+    int fresh = map == NULL;
+    if (fresh)
+        my_enforce_budget(len);
+    if (fresh && align > ps)
+        map = blka_map_aligned(len, align);
+    else if (fresh)
+        map = blka_map(len);
+    if (map == NULL)
     {
-        blka_remove(alloc, m);
+        meta_free(m);
         return NULL;
     }
 
-    void *start_point = (void *)((char *)m + offset);
+    // Nothing touched the fresh pages yet, this thread does on this node
+    if (fresh)
+        numa_bind(map, len, node);
+    m->size = len;
+
+    // A large mapping holds a single block, whatever its rounding tail
+    size_t usable = len;
+    if (index == BUCKET_COUNT)
+        usable = block_size;
 
-    recycler_create(&r, block_size, map_len - offset, start_point);
-    if (r == NULL)
+    struct recycler *r = (struct recycler *)(m + 1);
+    if (len >= block_size)
+        recycler_create(&r, block_size, usable, map);
+    else
+        r = NULL;
+    if (r != NULL)
+        r->class_index = index;
+    if (r == NULL || pagemap_set(map, mapped_extent(m), m) != 0)
     {
-        blka_remove(alloc, m);
+        blka_unmap(map, len);
+        meta_free(m);
         return NULL;
     }
+    r->node = node;
 
+    // Fresh mappings are zero, pooled ones past zero
+    r->zero_from = (zero + block_size - 1) / block_size;
+
+    add_block_to_list(&arenas[node][index], m);
+    usage[index].spans++;
+    usage[index].bytes += len;
+    usage[index].capacity += r->capacity;
     return m;
 }
 
-void *my_malloc(size_t size)
+size_t my_size_class(size_t size)
 {
-    if (size == 0)
-        return NULL;
-
     size_t aligned_req = size_align(size);
-    // Critical: size_align returns 0 on overflow
-    if (aligned_req == 0)
-        return NULL;
+    if (size == 0 || aligned_req == 0)
+        return BUCKET_COUNT;
+
+    return get_bucket_index(size);
+}
+
+size_t my_class_size(size_t index)
+{
+    return get_size_for_index(index);
+}
 
-    size_t bucket_idx = get_bucket_index(aligned_req);
-    struct blk_allocator *alloc = &buckets[bucket_idx];
+size_t my_block_class(void *ptr)
+{
+    struct blk_meta *m = pagemap_get(ptr);
+    if (m == NULL)
+        return BUCKET_COUNT;
 
-    size_t actual_block_size = (bucket_idx < BUCKET_COUNT)
-        ? get_size_for_index(bucket_idx)
-        : aligned_req;
+    struct recycler *r = (struct recycler *)(m + 1);
+    return r->class_index;
+}
 
+uintptr_t my_block_owner(void *ptr)
+{
+    struct blk_meta *m = pagemap_get(ptr);
+    if (m == NULL)
+        return 0;
+
+    struct recycler *r = (struct recycler *)(m + 1);
+    return __atomic_load_n(&r->owner, __ATOMIC_RELAXED);
+}
+
+void my_free_remote(void *ptr)
+{
+    struct blk_meta *m = pagemap_get(ptr);
+    if (m == NULL)
+        return;
+
+    struct recycler *r = (struct recycler *)(m + 1);
+    if (!recycler_remote_free(r, ptr))
+        return;
+
+    // First remote free since the last collection: announce the page. It
+    // cannot be unmapped before the collector has seen it.
+    struct recycler *head = __atomic_load_n(&remote_pages, __ATOMIC_RELAXED);
+    do
+    {
+        r->remote_next = head;
+    } while (!__atomic_compare_exchange_n(&remote_pages, &head, r, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void my_remote_collect(void)
+{
+    if (__atomic_load_n(&remote_pages, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    struct recycler *r =
+        __atomic_exchange_n(&remote_pages, NULL, __ATOMIC_ACQUIRE);
+    while (r != NULL)
+    {
+        // Read the link first, settling may unmap the page
+        struct recycler *next = r->remote_next;
+        struct blk_meta *m = (struct blk_meta *)r - 1;
+        int was_full = recycler_full(r);
+
+        uncount_blocks(r, recycler_collect(r, 1));
+        settle_page(m, was_full);
+        r = next;
+    }
+}
+
+// A free list recycler_allocate refuses is corrupt. Its blocks are given up
+// until the page is released, and the page leaves the list once nothing is
+// left to carve, so that it is not tried again and again.
+static void drop_free_list(struct blk_allocator *alloc, struct blk_meta *m)
+{
+    struct recycler *r = (struct recycler *)(m + 1);
+    r->free = NULL;
+    if (recycler_full(r))
+        remove_block_from_list(alloc, m);
+}
+
+size_t my_malloc_batch(size_t index, void **out, size_t n, uintptr_t owner)
+{
+    if (index >= BUCKET_COUNT || out == NULL)
+        return 0;
+
+    my_remote_collect();
+
+    size_t node = numa_node();
+    struct blk_allocator *alloc = &arenas[node][index];
+    size_t block_size = get_size_for_index(index);
+    size_t count = 0;
+
+    while (count < n)
+    {
+        // Every span kept in a bucket list has at least one free block
+        struct blk_meta *m = alloc->meta;
+        if (m == NULL)
+        {
+            m = new_page(node, index, block_size, 0);
+            if (m == NULL)
+                break;
+        }
+
+        struct recycler *r = (struct recycler *)(m + 1);
+        __atomic_store_n(&r->owner, owner, __ATOMIC_RELAXED);
+        uncount_blocks(r, recycler_collect(r, 0));
+
+        void *p = NULL;
+        size_t first = count;
+        while (count < n && (p = recycler_allocate(r)) != NULL)
+            out[count++] = p;
+        count_blocks(r, count - first);
+
+        if (p == NULL && !recycler_full(r))
+            drop_free_list(alloc, m);
+        else if (recycler_full(r))
+            remove_block_from_list(alloc, m);
+    }
+
+    return count;
+}
+
+// Takes a block from the first span of a class with a free one in the arena
+// of the node. zeroed, if not NULL, tells whether the block is known to be
+// zero-filled.
+static void *class_malloc(size_t node, size_t index, int *zeroed)
+{
+    struct blk_allocator *alloc = &arenas[node][index];
+    size_t block_size = get_size_for_index(index);
     struct blk_meta *m = alloc->meta;
     struct recycler *r = NULL;
 
@@ -117,59 +461,202 @@ void *my_malloc(size_t size)
     while (m != NULL)
     {
         r = (struct recycler *)(m + 1);
-        if (r->block_size >= actual_block_size && r->free != NULL)
+        if (r->block_size >= block_size && !recycler_full(r))
             break;
         m = m->next;
     }
 
     if (m == NULL)
     {
-        m = new_page(alloc, actual_block_size);
+        m = new_page(node, index, block_size, 0);
         if (m == NULL)
             return NULL;
         r = (struct recycler *)(m + 1);
     }
 
+    if (zeroed != NULL)
+        *zeroed = recycler_next_zeroed(r);
     void *p = recycler_allocate(r);
+    if (p == NULL && !recycler_full(r))
+    {
+        drop_free_list(alloc, m);
+        return class_malloc(node, index, zeroed);
+    }
+    if (p != NULL)
+        count_blocks(r, 1);
 
     // If page became full, remove it from list
-    if (p != NULL && r->free == NULL)
+    if (p != NULL && recycler_full(r))
         remove_block_from_list(alloc, m);
 
     return p;
 }
 
-void my_free(void *ptr)
+// Free large mappings wait in the page pool. A large block fills its
+// mapping, which leaves the bucket list as soon as it is handed out.
+static void *large_malloc(size_t node, size_t size, size_t align,
+                          int *zeroed)
 {
-    if (ptr == NULL)
-        return;
+    struct blk_meta *m = new_page(node, BUCKET_COUNT, size, align);
+    if (m == NULL)
+        return NULL;
+
+    struct recycler *r = (struct recycler *)(m + 1);
+    if (zeroed != NULL)
+        *zeroed = recycler_next_zeroed(r);
+    void *p = recycler_allocate(r);
+    if (p != NULL)
+        count_blocks(r, 1);
+    if (p != NULL && recycler_full(r))
+        remove_block_from_list(&arenas[node][BUCKET_COUNT], m);
+
+    return p;
+}
 
+static void *do_malloc(size_t size, int *zeroed)
+{
+    if (size == 0)
+        return NULL;
+
+    size_t aligned_req = size_align(size);
+    // Critical: size_align returns 0 on overflow
+    if (aligned_req == 0)
+        return NULL;
+
+    my_remote_collect();
+
+    size_t node = numa_node();
+    size_t bucket_idx = get_bucket_index(size);
+    if (bucket_idx < BUCKET_COUNT)
+        return class_malloc(node, bucket_idx, zeroed);
+    return large_malloc(node, aligned_req, ALIGNMENT, zeroed);
+}
+
+void *my_malloc(size_t size)
+{
+    return do_malloc(size, NULL);
+}
+
+size_t my_aligned_class(size_t alignment, size_t size)
+{
     size_t ps = tools_page_size();
-    if (ps == 0)
+    if (alignment == 0 || ps == 0 || alignment > ps)
+        return BUCKET_COUNT;
+
+    // No class smaller than the alignment is a multiple of it
+    size_t idx = my_size_class(size < alignment ? alignment : size);
+    while (idx < BUCKET_COUNT && class_sizes[idx] % alignment != 0)
+        idx++;
+    return idx;
+}
+
+void *my_memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || size == 0)
+        return NULL;
+
+    size_t aligned_req = size_align(size);
+    if (aligned_req == 0)
+        return NULL;
+
+    my_remote_collect();
+
+    size_t node = numa_node();
+    size_t idx = my_aligned_class(alignment, size);
+    if (idx < BUCKET_COUNT)
+        return class_malloc(node, idx, NULL);
+    return large_malloc(node, aligned_req,
+                        alignment < ALIGNMENT ? ALIGNMENT : alignment, NULL);
+}
+
+size_t my_usable_size(void *ptr)
+{
+    struct blk_meta *m = pagemap_get(ptr);
+    if (m == NULL)
+        return 0;
+
+    struct recycler *r = (struct recycler *)(m + 1);
+    return r->block_size;
+}
+
+void my_free(void *ptr)
+{
+    if (ptr == NULL)
         return;
 
-    struct blk_meta *m = page_begin(ptr, ps);
+    struct blk_meta *m = pagemap_get(ptr);
     if (m == NULL)
         return;
 
     struct recycler *r = (struct recycler *)(m + 1);
 
-    // If it was full (free list empty), it is likely not in any bucket list.
-    // Re-add it before freeing so it can be used again.
-    if (r->free == NULL)
+    // If it was full (free list empty), it is not in any bucket list
+    int was_full = recycler_full(r);
+
+    size_t before = r->allocated;
+    recycler_free(r, ptr);
+    uncount_blocks(r, before - r->allocated);
+    settle_page(m, was_full);
+}
+
+void my_free_batch(void **ptrs, size_t n)
+{
+    size_t i = 0;
+    while (i < n)
     {
-        size_t idx = get_bucket_index(r->block_size);
-        add_block_to_list(&buckets[idx], m);
+        struct blk_meta *m = ptrs[i] != NULL ? pagemap_get(ptrs[i]) : NULL;
+        if (m == NULL)
+        {
+            i++;
+            continue;
+        }
+
+        struct recycler *r = (struct recycler *)(m + 1);
+        uintptr_t start = (uintptr_t)r->chunk;
+        uintptr_t end = start + m->size;
+        int was_full = recycler_full(r);
+        size_t before = r->allocated;
+
+        // The blocks of the page follow each other, with no page map lookup
+        for (; i < n && (uintptr_t)ptrs[i] >= start && (uintptr_t)ptrs[i] < end;
+             i++)
+            recycler_free(r, ptrs[i]);
+
+        uncount_blocks(r, before - r->allocated);
+        settle_page(m, was_full);
     }
+}
 
-    recycler_free(r, ptr);
+// Large blocks are resized in place: the tail is unmapped on shrink, and
+// mremap moves the pages without copying them on growth
+static void *realloc_large(struct blk_meta *m, size_t size)
+{
+    struct recycler *r = (struct recycler *)(m + 1);
+    size_t aligned_req = size_align(size);
+    size_t ps = tools_page_size();
+    if (aligned_req == 0 || ps == 0 || aligned_req > SIZE_MAX - (ps - 1))
+        return NULL;
 
-    // If recycler now empty, remove from list and unmap
-    if (r->allocated == 0)
+    // A moved block loses any alignment beyond the page size
+    size_t len = (aligned_req + (ps - 1)) & ~(ps - 1);
+    size_t old_len = m->size;
+    void *n = blka_remap(r->chunk, old_len, len);
+    if (n == NULL)
+        return aligned_req <= r->block_size ? r->chunk : NULL;
+
+    if (n != r->chunk)
     {
-        size_t idx = get_bucket_index(r->block_size);
-        blka_remove(&buckets[idx], m);
+        pagemap_clear(r->chunk, mapped_extent(m));
+        // A failed leaf only makes the block unknown to my_free, it leaks
+        pagemap_set(n, mapped_extent(m), m);
     }
+
+    usage[BUCKET_COUNT].bytes += len - old_len;
+    usage[BUCKET_COUNT].block_bytes += aligned_req - r->block_size;
+    m->size = len;
+    r->chunk = n;
+    r->block_size = aligned_req;
+    return n;
 }
 
 void *my_realloc(void *ptr, size_t size)
@@ -183,38 +670,97 @@ void *my_realloc(void *ptr, size_t size)
     if (ptr == NULL)
         return my_malloc(size);
 
-    size_t ps = tools_page_size();
-    if (ps == 0)
-        return NULL;
-
-    struct blk_meta *m = page_begin(ptr, ps);
+    struct blk_meta *m = pagemap_get(ptr);
     if (m == NULL)
         return NULL;
 
     struct recycler *r = (struct recycler *)(m + 1);
+    size_t idx = get_bucket_index(size);
+
+    if (r->class_index == BUCKET_COUNT && idx == BUCKET_COUNT)
+    {
+        void *p = realloc_large(m, size);
+        // Hugetlb mappings may refuse to be remapped, they are copied
+        if (p != NULL || size <= r->block_size)
+            return p;
+    }
 
+    size_t copy = r->block_size;
     if (size <= r->block_size)
-        return ptr;
+    {
+        // Keep the block unless a much smaller class can hold the data
+        if (idx == BUCKET_COUNT
+            || get_size_for_index(idx) * REALLOC_SHRINK_DIV > r->block_size)
+            return ptr;
+        copy = size;
+    }
 
     void *n = my_malloc(size);
     if (n == NULL)
-        return NULL;
+        return size <= r->block_size ? ptr : NULL;
 
-    memmove(n, ptr, r->block_size);
+    memcpy(n, ptr, copy);
     my_free(ptr);
     return n;
 }
 
+// Whole pages of a large block are dropped with MADV_DONTNEED and read back
+// as zero pages on their next fault, only the partial ones are written
+static void clear_large(void *p, size_t n)
+{
+    size_t ps = tools_page_size();
+    uintptr_t start = ((uintptr_t)p + (ps - 1)) & ~(uintptr_t)(ps - 1);
+    uintptr_t end = ((uintptr_t)p + n) & ~(uintptr_t)(ps - 1);
+
+    if (ps == 0 || end <= start
+        || madvise((void *)start, end - start, MADV_DONTNEED) != 0)
+    {
+        memset(p, 0, n);
+        return;
+    }
+
+    memset(p, 0, start - (uintptr_t)p);
+    memset((void *)end, 0, (uintptr_t)p + n - end);
+}
+
 void *my_calloc(size_t nmemb, size_t size)
 {
     if (nmemb != 0 && size > SIZE_MAX / nmemb)
         return NULL;
 
+    // Blocks carved from a fresh mapping are already zero
     size_t total = nmemb * size;
-    void *p = my_malloc(total);
-    if (p == NULL)
-        return NULL;
+    int zeroed = 0;
+    void *p = do_malloc(total, &zeroed);
+    if (p == NULL || zeroed)
+        return p;
 
-    memset(p, 0, total);
+    if (total > conf.large_threshold)
+        clear_large(p, total);
+    else
+        memset(p, 0, total);
     return p;
 }
+
+void my_class_usage(size_t index, struct my_class_usage *u)
+{
+    if (index > BUCKET_COUNT)
+        return;
+    *u = usage[index];
+}
+
+void my_heap_usage(struct my_heap_usage *u)
+{
+    u->pooled_bytes = pool_bytes();
+    u->meta_bytes = meta_bytes();
+    u->region_bytes = region_bytes();
+    blka_counts(&u->maps, &u->unmaps);
+}
+
+size_t my_trim(void)
+{
+    size_t before = heap_bytes();
+    my_remote_collect();
+    pool_release();
+    return before - heap_bytes();
+}
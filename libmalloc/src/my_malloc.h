@@ -2,6 +2,77 @@
 #define MY_MALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#define MIN_BLOCK_SIZE 16
+
+/**
+ * @brief Built with MY_TINY_CLASS, requests of up to 8 bytes get an 8-byte
+ * class whose blocks are only 8-byte aligned.
+ */
+#ifdef MY_TINY_CLASS
+#    define TINY_CLASS_COUNT 1
+#else
+#    define TINY_CLASS_COUNT 0
+#endif
+
+/**
+ * @brief Small classes go in 16-byte steps up to 64 bytes, then in four steps
+ * per power of two up to SMALL_MAX_SIZE.
+ */
+#define SMALL_MAX_SIZE 1024
+#define SMALL_CLASS_COUNT (TINY_CLASS_COUNT + 20)
+
+/**
+ * @brief Medium classes keep four steps per power of two above SMALL_MAX_SIZE
+ * up to MAX_BUCKET_SIZE, and are carved from multi-page spans.
+ */
+#define MAX_BUCKET_SIZE (256 * 1024)
+#define MEDIUM_CLASS_COUNT 32
+
+#define BUCKET_COUNT (SMALL_CLASS_COUNT + MEDIUM_CLASS_COUNT)
+
+/**
+ * @brief Classes up to 4 KiB are served by the thread and per-CPU caches,
+ * larger ones always take the allocator lock.
+ */
+#define CACHE_CLASS_COUNT (SMALL_CLASS_COUNT + 8)
+
+/**
+ * @brief Requests above this size get a mapping of their own.
+ */
+#ifndef LARGE_THRESHOLD
+#    define LARGE_THRESHOLD MAX_BUCKET_SIZE
+#endif
+
+#if LARGE_THRESHOLD > MAX_BUCKET_SIZE
+#    error "LARGE_THRESHOLD must not exceed MAX_BUCKET_SIZE"
+#endif
+
+/**
+ * @brief A block shrunk by realloc moves to a smaller class once that class
+ * is at most 1 / REALLOC_SHRINK_DIV of its current one.
+ */
+#ifndef REALLOC_SHRINK_DIV
+#    define REALLOC_SHRINK_DIV 2
+#endif
+
+/**
+ * @brief Upper bound on the number of pages of a span.
+ */
+#define SPAN_MAX_PAGES 128
+
+/**
+ * @brief A span holds at least this many blocks, or as many as fit in
+ * SPAN_MAX_PAGES.
+ */
+#define SPAN_MIN_BLOCKS 4
+
+/**
+ * @brief A span is grown until at most 1 / SPAN_WASTE_DIV of it is lost to
+ * the tail that cannot hold a block.
+ */
+#define SPAN_WASTE_DIV 8
 
 /**
  * @brief Allocates a block of memory of a specified size.
@@ -20,6 +91,19 @@ void *my_malloc(size_t size);
  */
 void my_free(void *ptr);
 
+/**
+ * @brief Frees many blocks, releasing the blocks of each page together and
+ * settling the page once.
+ *
+ * Must be called with the allocator lock held. Blocks are grouped by page as
+ * they come, so the array should be sorted by address, see sort_pointers.
+ * NULL and unknown pointers are skipped.
+ *
+ * @param ptrs The blocks to free.
+ * @param n Number of pointers in ptrs.
+ */
+void my_free_batch(void **ptrs, size_t n);
+
 /**
  * @brief Reallocates a block of memory to a new size, preserving the existing
  * data.
@@ -43,4 +127,177 @@ void *my_realloc(void *ptr, size_t size);
  */
 void *my_calloc(size_t nmemb, size_t size);
 
+/**
+ * @brief Allocates a block whose address is a multiple of a given alignment.
+ *
+ * Alignments up to the page size are served from a size class that is a
+ * multiple of the alignment, whose blocks are naturally aligned; larger ones
+ * get a mapping of their own.
+ *
+ * @param alignment The alignment, a power of two.
+ * @param size The size of the memory block to allocate, in bytes.
+ * @return A pointer to the allocated memory, or NULL if the alignment is not
+ * a power of two or the allocation fails.
+ */
+void *my_memalign(size_t alignment, size_t size);
+
+/**
+ * @brief Returns the number of usable bytes of a block.
+ *
+ * Like my_block_class, may be called without the allocator lock.
+ *
+ * @param ptr Pointer to a live block.
+ * @return The block size, at least the size requested for it, or 0 for NULL
+ * or unknown pointers.
+ */
+size_t my_usable_size(void *ptr);
+
+/**
+ * @brief Returns the size class serving a request of a given size.
+ *
+ * @param size The requested size, in bytes.
+ * @return The class index, or BUCKET_COUNT if the request is zero-sized,
+ * overflows or is served by the large-object bucket.
+ */
+size_t my_size_class(size_t size);
+
+/**
+ * @brief Returns the size class serving an aligned request of a given size.
+ *
+ * @param alignment The alignment, a power of two.
+ * @param size The requested size, in bytes.
+ * @return The smallest class holding the size whose blocks are aligned to
+ * alignment, or BUCKET_COUNT if the request needs a large block.
+ */
+size_t my_aligned_class(size_t alignment, size_t size);
+
+/**
+ * @brief Returns the block size of a size class.
+ *
+ * @param index The class index, as returned by my_size_class.
+ * @return The block size in bytes, or 0 if the index is not a size class.
+ */
+size_t my_class_size(size_t index);
+
+/**
+ * @brief Returns the size class of a block previously returned by my_malloc.
+ *
+ * Only reads the immutable header of the page holding the block, so it may be
+ * called without holding the allocator lock as long as the block is live.
+ *
+ * @param ptr Pointer to a live block.
+ * @return The class index, or BUCKET_COUNT for large or unknown blocks.
+ */
+size_t my_block_class(void *ptr);
+
+/**
+ * @brief Allocates up to n blocks of a size class in one pass over the class's
+ * spans.
+ *
+ * Blocks freed remotely on the visited pages are collected first, and the
+ * pages become owned by the caller.
+ *
+ * @param index The class index, must be lower than BUCKET_COUNT.
+ * @param out Array receiving the allocated blocks.
+ * @param n Maximum number of blocks to allocate.
+ * @param owner Identifier of the calling thread cache, 0 for none.
+ * @return The number of blocks stored in out.
+ */
+size_t my_malloc_batch(size_t index, void **out, size_t n, uintptr_t owner);
+
+/**
+ * @brief Returns the owner of the page holding a block.
+ *
+ * Like my_block_class, may be called without the allocator lock. The owner
+ * is only a routing hint and may change at any time.
+ *
+ * @param ptr Pointer to a live block.
+ * @return The owner passed to the last my_malloc_batch on the page, 0 if
+ * none.
+ */
+uintptr_t my_block_owner(void *ptr);
+
+/**
+ * @brief Frees a block without taking the allocator lock.
+ *
+ * The block is pushed onto its page's remote free list and given back to the
+ * page by the next my_malloc_batch on that page or by my_remote_collect.
+ *
+ * @param ptr Pointer to a live block of a size class.
+ */
+void my_free_remote(void *ptr);
+
+/**
+ * @brief Collects the remote free lists of every page announced by
+ * my_free_remote, releasing the pages that became empty.
+ *
+ * Must be called with the allocator lock held. Also run by my_malloc and
+ * my_malloc_batch.
+ */
+void my_remote_collect(void);
+
+/**
+ * @brief Spans and blocks held by a size class or by the large bucket.
+ */
+struct my_class_usage
+{
+    size_t spans; ///< Spans, or large mappings, in use.
+    size_t bytes; ///< Bytes of those spans.
+    size_t blocks; ///< Blocks allocated from them, cached ones included.
+    size_t capacity; ///< Blocks they can hold.
+    size_t block_bytes; ///< Bytes of the allocated blocks.
+};
+
+/**
+ * @brief Reads the spans and blocks held by a size class.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param index The class index, or BUCKET_COUNT for the large bucket.
+ * @param usage Receives the usage, left untouched for a bad index.
+ */
+void my_class_usage(size_t index, struct my_class_usage *usage);
+
+/**
+ * @brief Memory held by the allocator outside of the classes.
+ */
+struct my_heap_usage
+{
+    size_t pooled_bytes; ///< Bytes of the empty spans kept in the page pool.
+    size_t meta_bytes; ///< Bytes of the slabs holding the span headers.
+    size_t region_bytes; ///< Bytes of the chunks of the arenas.
+    uint64_t maps; ///< mmap and mremap calls made so far.
+    uint64_t unmaps; ///< munmap calls made so far.
+};
+
+/**
+ * @brief Reads the memory held by the allocator outside of the classes.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param usage Receives the usage.
+ */
+void my_heap_usage(struct my_heap_usage *usage);
+
+/**
+ * @brief Unmaps the empty spans kept in the page pool, after collecting the
+ * remote frees that may empty more of them.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @return The number of bytes unmapped.
+ */
+size_t my_trim(void);
+
+/**
+ * @brief Enforces conf.mem_limit before mapping more: once the heap would go
+ * over it, the empty spans of the pool are unmapped at once and the thread
+ * caches are asked to give their blocks back, see budget_flush_over_limit.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param extra Bytes about to be mapped.
+ */
+void my_enforce_budget(size_t extra);
+
 #endif /* !MY_MALLOC_H */
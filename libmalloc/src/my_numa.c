@@ -0,0 +1,143 @@
+// sched_getcpu is a GNU extension
+#define _GNU_SOURCE
+
+#include "my_numa.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Preferred rather than bound: a full node spills over to the others
+#define NUMA_MPOL_PREFERRED 1
+
+#define NODE_DIR "/sys/devices/system/node/"
+
+// 0 until the topology is read, then the number of arenas
+static size_t node_count;
+static uint8_t cpu_node[NUMA_MAX_CPUS];
+
+// Reads a small sysfs file into buf as a string, without allocating
+static int read_file(const char *path, char *buf, size_t len)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    size_t done = 0;
+    ssize_t n;
+    while (done < len - 1 && (n = read(fd, buf + done, len - 1 - done)) > 0)
+        done += (size_t)n;
+    close(fd);
+
+    buf[done] = '\0';
+    return done > 0 ? 0 : -1;
+}
+
+static const char *parse_num(const char *s, size_t *out)
+{
+    size_t n = 0;
+    while (*s >= '0' && *s <= '9')
+        n = n * 10 + (size_t)(*s++ - '0');
+    *out = n;
+    return s;
+}
+
+// Calls fn on each range of a sysfs list such as "0-3,8,10-11"
+static void for_each_range(const char *s, void (*fn)(size_t, size_t, size_t),
+                           size_t arg)
+{
+    while (*s >= '0' && *s <= '9')
+    {
+        size_t first;
+        size_t last;
+        s = parse_num(s, &first);
+        last = first;
+        if (*s == '-')
+            s = parse_num(s + 1, &last);
+        fn(first, last, arg);
+        if (*s == ',')
+            s++;
+    }
+}
+
+static void note_node(size_t first, size_t last, size_t arg)
+{
+    (void)first;
+    (void)arg;
+    if (last + 1 > node_count)
+        node_count = last + 1;
+}
+
+static void note_cpus(size_t first, size_t last, size_t node)
+{
+    for (size_t cpu = first; cpu <= last && cpu < NUMA_MAX_CPUS; cpu++)
+        cpu_node[cpu] = (uint8_t)node;
+}
+
+static void read_topology(void)
+{
+    char buf[512];
+    if (read_file(NODE_DIR "online", buf, sizeof(buf)) == 0)
+        for_each_range(buf, note_node, 0);
+    if (node_count > NUMA_MAX_NODES)
+        node_count = NUMA_MAX_NODES;
+    if (node_count <= 1)
+    {
+        node_count = 1;
+        return;
+    }
+
+    // NODE_DIR "node<n>/cpulist", n below NUMA_MAX_NODES
+    char path[64] = NODE_DIR "node";
+    size_t dir = sizeof(NODE_DIR "node") - 1;
+    for (size_t node = 1; node < node_count; node++)
+    {
+        size_t i = dir;
+        if (node >= 10)
+            path[i++] = (char)('0' + node / 10);
+        path[i++] = (char)('0' + node % 10);
+        const char *file = "/cpulist";
+        while (*file != '\0')
+            path[i++] = *file++;
+        path[i] = '\0';
+
+        if (read_file(path, buf, sizeof(buf)) == 0)
+            for_each_range(buf, note_cpus, node);
+    }
+}
+
+size_t numa_node_count(void)
+{
+    if (node_count == 0)
+        read_topology();
+    return node_count;
+}
+
+size_t numa_node(void)
+{
+    if (numa_node_count() == 1)
+        return 0;
+
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= NUMA_MAX_CPUS)
+        return 0;
+    return cpu_node[cpu];
+}
+
+void numa_bind(void *addr, size_t len, size_t node)
+{
+    if (numa_node_count() == 1)
+        return;
+
+#ifdef SYS_mbind
+    unsigned long mask = 1UL << node;
+    // Best effort: the pages are placed on first touch otherwise
+    syscall(SYS_mbind, addr, len, NUMA_MPOL_PREFERRED, &mask,
+            sizeof(mask) * 8, 0);
+#else
+    (void)addr;
+    (void)len;
+#endif
+}
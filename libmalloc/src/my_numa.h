@@ -0,0 +1,52 @@
+#ifndef MY_NUMA_H
+#define MY_NUMA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Most NUMA nodes given an arena of their own. CPUs of nodes beyond
+ * it share the arena of node 0.
+ */
+#ifndef NUMA_MAX_NODES
+#    define NUMA_MAX_NODES 8
+#endif
+
+/**
+ * @brief Most CPUs mapped to their node, higher CPUs use node 0.
+ */
+#ifndef NUMA_MAX_CPUS
+#    define NUMA_MAX_CPUS 1024
+#endif
+
+/**
+ * @brief Returns the number of arenas: the highest online node plus one, up
+ * to NUMA_MAX_NODES, and 1 on single-node machines or without sysfs.
+ *
+ * Reads the node topology from sysfs on its first call, which must be made
+ * with the allocator lock held.
+ */
+size_t numa_node_count(void);
+
+/**
+ * @brief Returns the node of the CPU the calling thread runs on.
+ *
+ * Must be called with the allocator lock held. Costs nothing on a single
+ * node, where it is always 0.
+ *
+ * @return The node, below numa_node_count().
+ */
+size_t numa_node(void);
+
+/**
+ * @brief Asks the kernel to place the pages of a fresh mapping on a node,
+ * falling back to other nodes when it is out of memory.
+ *
+ * A no-op on a single node. Pages already faulted in are not moved.
+ *
+ * @param addr Start of the mapping, page aligned.
+ * @param len Length of the mapping, in bytes.
+ * @param node The node, below numa_node_count().
+ */
+void numa_bind(void *addr, size_t len, size_t node);
+
+#endif /* !MY_NUMA_H */
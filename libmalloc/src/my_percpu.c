@@ -0,0 +1,177 @@
+#include "my_percpu.h"
+
+#ifndef PERCPU_SUPPORTED
+#    error "per-CPU caches need x86-64 and <sys/rseq.h>"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define PERCPU_BIN_BYTES (16 * 1024)
+
+struct percpu_cache *percpu_caches;
+static size_t g_limits[CACHE_CLASS_COUNT];
+static int g_unsupported;
+
+static inline struct rseq *thread_rseq(void)
+{
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+// Critical section descriptor, kept in __rseq_cs so the kernel can find where
+// the sequence starts (1), commits (2) and aborts to (4). The abort handler
+// must be preceded by the signature glibc registered rseq with.
+#define RSEQ_CS_TABLE                                                          \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                                       \
+    ".balign 32\n\t"                                                           \
+    "3:\n\t"                                                                   \
+    ".long 0x0, 0x0\n\t"                                                       \
+    ".quad 1f, (2f - 1f), 4f\n\t"                                              \
+    ".popsection\n\t"                                                          \
+    "leaq 3b(%%rip), %%rax\n\t"                                                \
+    "movq %%rax, 8(%[rs])\n\t"
+
+#define RSEQ_CS_ABORT                                                          \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                                  \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                               \
+    ".long 0x53053053\n\t"                                                     \
+    "4:\n\t"                                                                   \
+    "jmp %l[abort]\n\t"                                                        \
+    ".popsection\n\t"
+
+// Returns 1 and stores the popped block in *out, 0 if the bin is empty, and -1
+// if the sequence was aborted and must be retried.
+static inline int rseq_pop(struct rseq *rs, uint32_t cpu,
+                           struct percpu_bin *bin, void **out)
+{
+    __asm__ goto(RSEQ_CS_TABLE
+                 "1:\n\t"
+                 "cmpl %[cpu], 4(%[rs])\n\t"
+                 "jnz %l[abort]\n\t"
+                 "movq (%[count]), %%rax\n\t"
+                 "testq %%rax, %%rax\n\t"
+                 "jz %l[empty]\n\t"
+                 "movq -8(%[slots], %%rax, 8), %%rcx\n\t"
+                 "movq %%rcx, (%[out])\n\t"
+                 "decq %%rax\n\t"
+                 "movq %%rax, (%[count])\n\t"
+                 "2:\n\t" RSEQ_CS_ABORT
+                 :
+                 : [rs] "r"(rs), [cpu] "r"(cpu), [count] "r"(&bin->count),
+                   [slots] "r"(bin->slots), [out] "r"(out)
+                 : "memory", "cc", "rax", "rcx"
+                 : abort, empty);
+    return 1;
+abort:
+    return -1;
+empty:
+    return 0;
+}
+
+// Returns 1 if the block was pushed, 0 if the bin is full, and -1 if the
+// sequence was aborted and must be retried.
+static inline int rseq_push(struct rseq *rs, uint32_t cpu,
+                            struct percpu_bin *bin, size_t limit, void *ptr)
+{
+    __asm__ goto(RSEQ_CS_TABLE
+                 "1:\n\t"
+                 "cmpl %[cpu], 4(%[rs])\n\t"
+                 "jnz %l[abort]\n\t"
+                 "movq (%[count]), %%rax\n\t"
+                 "cmpq %[limit], %%rax\n\t"
+                 "jae %l[full]\n\t"
+                 "movq %[ptr], (%[slots], %%rax, 8)\n\t"
+                 "incq %%rax\n\t"
+                 "movq %%rax, (%[count])\n\t"
+                 "2:\n\t" RSEQ_CS_ABORT
+                 :
+                 : [rs] "r"(rs), [cpu] "r"(cpu), [count] "r"(&bin->count),
+                   [slots] "r"(bin->slots), [limit] "r"(limit), [ptr] "r"(ptr)
+                 : "memory", "cc", "rax"
+                 : abort, full);
+    return 1;
+abort:
+    return -1;
+full:
+    return 0;
+}
+
+int percpu_init(void)
+{
+    if (__atomic_load_n(&percpu_caches, __ATOMIC_ACQUIRE) != NULL)
+        return 1;
+
+    if (g_unsupported)
+        return 0;
+
+    // Zero when the C library did not register rseq (old kernel or tunable)
+    if (__rseq_size == 0)
+    {
+        g_unsupported = 1;
+        return 0;
+    }
+
+    for (size_t i = 0; i < CACHE_CLASS_COUNT; i++)
+    {
+        size_t limit = PERCPU_BIN_BYTES / my_class_size(i);
+        if (limit > PERCPU_CAPACITY)
+            limit = PERCPU_CAPACITY;
+        if (limit < 4)
+            limit = 4;
+        g_limits[i] = limit;
+    }
+
+    // Reserved only, pages of CPUs that never allocate are never touched
+    void *area = mmap(NULL, PERCPU_MAX_CPUS * sizeof(struct percpu_cache),
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        g_unsupported = 1;
+        return 0;
+    }
+
+    __atomic_store_n(&percpu_caches, (struct percpu_cache *)area,
+                     __ATOMIC_RELEASE);
+    return 1;
+}
+
+void *percpu_alloc(size_t index)
+{
+    struct rseq *rs = thread_rseq();
+
+    for (;;)
+    {
+        uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        if (cpu >= PERCPU_MAX_CPUS)
+            return NULL;
+
+        void *ptr = NULL;
+        int ret = rseq_pop(rs, cpu, &percpu_caches[cpu].bins[index], &ptr);
+        if (ret >= 0)
+            return ret ? ptr : NULL;
+    }
+}
+
+int percpu_free(size_t index, void *ptr)
+{
+    struct rseq *rs = thread_rseq();
+
+    for (;;)
+    {
+        uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        if (cpu >= PERCPU_MAX_CPUS)
+            return 0;
+
+        int ret = rseq_push(rs, cpu, &percpu_caches[cpu].bins[index],
+                            g_limits[index], ptr);
+        if (ret >= 0)
+            return ret;
+    }
+}
+
+size_t percpu_limit(size_t index)
+{
+    return g_limits[index];
+}
@@ -0,0 +1,146 @@
+#ifndef MY_PERCPU_H
+#define MY_PERCPU_H
+
+#include <stddef.h>
+
+#include "my_malloc.h"
+
+/**
+ * @brief Per-CPU caches are only built with -DMY_PERCPU (make PERCPU=1) on
+ * x86-64, and only used at run time when the C library registered rseq.
+ */
+#if defined(MY_PERCPU) && defined(__x86_64__) && defined(__has_include)
+#    if __has_include(<sys/rseq.h>)
+#        define PERCPU_SUPPORTED 1
+#    endif
+#endif
+
+/**
+ * @brief Number of slots of a per-CPU bin, the per-class limit is lower for
+ * large classes.
+ */
+#define PERCPU_CAPACITY 64
+
+/**
+ * @brief Highest number of CPUs served by the per-CPU caches, threads running
+ * on higher CPU numbers use the thread cache instead.
+ */
+#define PERCPU_MAX_CPUS 1024
+
+/**
+ * @brief Per-size-class stack of cached free blocks owned by one CPU.
+ *
+ * Only modified inside restartable sequences, which the kernel aborts on
+ * preemption, migration or signal delivery, so a plain load/store sequence is
+ * enough to pop or push.
+ */
+struct percpu_bin
+{
+    size_t count; ///< Number of used slots, committed last.
+    void *slots[PERCPU_CAPACITY]; ///< Cached blocks, most recent last.
+};
+
+/**
+ * @brief Set of bins owned by one CPU.
+ */
+struct percpu_cache
+{
+    struct percpu_bin bins[CACHE_CLASS_COUNT]; ///< One bin per cached class.
+} __attribute__((aligned(64)));
+
+#ifdef PERCPU_SUPPORTED
+
+#    include <sys/rseq.h>
+
+/**
+ * @brief Maps the per-CPU caches if rseq is registered for this process.
+ *
+ * Must be called with the allocator lock held. Later calls are no-ops.
+ *
+ * @return 1 if the per-CPU caches are usable, 0 otherwise.
+ */
+int percpu_init(void);
+
+/**
+ * @brief Per-CPU caches, NULL until percpu_init succeeded.
+ */
+extern struct percpu_cache *percpu_caches;
+
+/**
+ * @brief Tells whether the calling thread can use the per-CPU caches.
+ *
+ * @return 1 if the caches are mapped and rseq is registered for the thread.
+ */
+static inline int percpu_available(void)
+{
+    if (__atomic_load_n(&percpu_caches, __ATOMIC_ACQUIRE) == NULL)
+        return 0;
+
+    // Unregistered threads read RSEQ_CPU_ID_UNINITIALIZED or
+    // RSEQ_CPU_ID_REGISTRATION_FAILED, both huge once unsigned
+    const struct rseq *rs = (const struct rseq *)(
+        (const char *)__builtin_thread_pointer() + __rseq_offset);
+    return __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED) < PERCPU_MAX_CPUS;
+}
+
+/**
+ * @brief Pops a cached block from the current CPU's bin.
+ *
+ * @param index The class index, must be lower than CACHE_CLASS_COUNT.
+ * @return A block, or NULL if the bin is empty.
+ */
+void *percpu_alloc(size_t index);
+
+/**
+ * @brief Pushes a block into the current CPU's bin.
+ *
+ * Double frees are not detected while the block sits in a per-CPU bin.
+ *
+ * @param index The class index of the block.
+ * @param ptr The block to cache.
+ * @return 1 if the block was consumed, 0 if the bin is full.
+ */
+int percpu_free(size_t index, void *ptr);
+
+/**
+ * @brief Returns the number of blocks a per-CPU bin keeps for a size class.
+ *
+ * @param index The class index.
+ * @return The bin limit.
+ */
+size_t percpu_limit(size_t index);
+
+#else
+
+static inline int percpu_init(void)
+{
+    return 0;
+}
+
+static inline int percpu_available(void)
+{
+    return 0;
+}
+
+static inline void *percpu_alloc(size_t index)
+{
+    (void)index;
+    return NULL;
+}
+
+static inline int percpu_free(size_t index, void *ptr)
+{
+    (void)index;
+    (void)ptr;
+    return 0;
+}
+
+static inline size_t percpu_limit(size_t index)
+{
+    (void)index;
+    return 0;
+}
+
+#endif /* PERCPU_SUPPORTED */
+
+#endif /* !MY_PERCPU_H */
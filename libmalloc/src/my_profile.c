@@ -0,0 +1,414 @@
+#include "my_profile.h"
+
+#include <execinfo.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Frames of the profiler and of the malloc hook left out of each backtrace
+#define PROFILE_SKIP 3
+
+// Bytes between two checks of a thread that allocated before profile_init
+#define PROFILE_RECHECK (1 << 16)
+
+// Slots probed before giving up on a full table
+#define PROFILE_PROBES 64
+
+// Hash of a stack table slot still being filled in
+#define STACK_BUSY 1
+
+// Live table key of a block that was freed, probing goes past it
+#define LIVE_FREED ((void *)1)
+
+/**
+ * @brief An allocation site: a backtrace and the samples taken there.
+ */
+struct prof_stack
+{
+    uint64_t hash; ///< Hash of pc, 0 while the slot is empty.
+    uint64_t allocs; ///< Samples taken.
+    uint64_t alloc_bytes; ///< Bytes requested by those samples.
+    uint64_t live; ///< Samples not freed yet.
+    uint64_t live_bytes; ///< Bytes requested by those samples.
+    int depth; ///< Frames in pc.
+    void *pc[PROFILE_MAX_DEPTH]; ///< Return addresses, innermost first.
+};
+
+/**
+ * @brief A sampled block, until it is freed.
+ */
+struct prof_live
+{
+    void *ptr; ///< The block, NULL if never used, LIVE_FREED once freed.
+    uint32_t stack; ///< Index of its allocation site.
+    size_t size; ///< Bytes requested.
+};
+
+int profile_active;
+
+static int initialized;
+static size_t rate;
+static struct prof_stack *stacks;
+static struct prof_live *live;
+static uint64_t seed = 0x9e3779b97f4a7c15u;
+static unsigned dump_seq;
+static char prefix[256] = "tinymalloc";
+
+// Set while taking a backtrace, which may allocate the first time
+static __thread int in_profiler;
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdu;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53u;
+    x ^= x >> 33;
+    return x;
+}
+
+static void *map_table(size_t len)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+int profile_start(size_t bytes)
+{
+    if (bytes == 0)
+        return -1;
+
+    if (stacks == NULL)
+    {
+        stacks = map_table(PROFILE_STACKS * sizeof(*stacks));
+        live = map_table(PROFILE_LIVE * sizeof(*live));
+        if (stacks == NULL || live == NULL)
+            return -1;
+
+        // Loads the unwinder now rather than inside a sampled allocation
+        void *pc[1];
+        in_profiler = 1;
+        backtrace(pc, 1);
+        in_profiler = 0;
+    }
+
+    rate = bytes;
+    profile_active = 1;
+    return 0;
+}
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    profile_dump_next();
+}
+
+static void start_from_env(void)
+{
+    const char *env = getenv("TINYMALLOC_PROF_RATE");
+    if (env == NULL || profile_start(strtoul(env, NULL, 10)) != 0)
+        return;
+
+    env = getenv("TINYMALLOC_PROF_PREFIX");
+    if (env != NULL && strlen(env) < sizeof(prefix))
+        strcpy(prefix, env);
+
+    env = getenv("TINYMALLOC_PROF_SIGNAL");
+    if (env != NULL)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(atoi(env), &sa, NULL);
+    }
+}
+
+void profile_init(void)
+{
+    start_from_env();
+
+    // Only now, the unwinder loaded by profile_start allocates on this thread
+    __atomic_store_n(&initialized, 1, __ATOMIC_RELAXED);
+}
+
+int64_t profile_next_interval(void)
+{
+    if (!profile_active)
+        return __atomic_load_n(&initialized, __ATOMIC_RELAXED)
+                   ? INT64_MAX
+                   : PROFILE_RECHECK;
+
+    // Uniform over [1, 2 * rate]: no libm, and the mean is still the rate
+    uint64_t r = mix(__atomic_add_fetch(&seed, 0x9e3779b97f4a7c15u,
+                                        __ATOMIC_RELAXED));
+    return (int64_t)(r % (2 * (uint64_t)rate) + 1);
+}
+
+static uint32_t find_stack(void **pc, int depth)
+{
+    uint64_t hash = (uint64_t)depth;
+    for (int i = 0; i < depth; i++)
+        hash = mix(hash ^ (uint64_t)(uintptr_t)pc[i]);
+    if (hash <= STACK_BUSY)
+        hash += 2;
+
+    for (size_t i = 0; i < PROFILE_PROBES; i++)
+    {
+        struct prof_stack *s = &stacks[(hash + i) % PROFILE_STACKS];
+        uint64_t h = __atomic_load_n(&s->hash, __ATOMIC_ACQUIRE);
+
+        if (h == 0)
+        {
+            if (!__atomic_compare_exchange_n(&s->hash, &h, STACK_BUSY, 0,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_ACQUIRE))
+                goto taken;
+
+            s->depth = depth;
+            memcpy(s->pc, pc, (size_t)depth * sizeof(*pc));
+            __atomic_store_n(&s->hash, hash, __ATOMIC_RELEASE);
+            return (uint32_t)(s - stacks);
+        }
+
+    taken:
+        // Another thread is filling the slot in, and may be adding this site
+        while (h == STACK_BUSY)
+            h = __atomic_load_n(&s->hash, __ATOMIC_ACQUIRE);
+
+        if (h == hash && s->depth == depth
+            && memcmp(s->pc, pc, (size_t)depth * sizeof(*pc)) == 0)
+            return (uint32_t)(s - stacks);
+    }
+
+    return UINT32_MAX;
+}
+
+static size_t live_slot(void *ptr)
+{
+    return (size_t)mix((uintptr_t)ptr) & (PROFILE_LIVE - 1);
+}
+
+void profile_record(void *ptr, size_t size)
+{
+    if (!profile_active || in_profiler)
+        return;
+
+    void *pc[PROFILE_MAX_DEPTH + PROFILE_SKIP];
+    in_profiler = 1;
+    int depth = backtrace(pc, PROFILE_MAX_DEPTH + PROFILE_SKIP);
+    in_profiler = 0;
+
+    int skip = depth > PROFILE_SKIP ? PROFILE_SKIP : 0;
+    uint32_t index = find_stack(pc + skip, depth - skip);
+    if (index == UINT32_MAX)
+        return;
+
+    struct prof_stack *s = &stacks[index];
+    __atomic_fetch_add(&s->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->alloc_bytes, size, __ATOMIC_RELAXED);
+
+    // Without a live slot the sample still counts in the cumulative profile
+    size_t slot = live_slot(ptr);
+    for (size_t i = 0; i < PROFILE_PROBES; i++)
+    {
+        struct prof_live *l = &live[(slot + i) & (PROFILE_LIVE - 1)];
+        void *old = __atomic_load_n(&l->ptr, __ATOMIC_RELAXED);
+        if (old != NULL && old != LIVE_FREED)
+            continue;
+
+        // Nobody frees ptr before malloc returns, the fields can follow
+        if (__atomic_compare_exchange_n(&l->ptr, &old, ptr, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            l->stack = index;
+            l->size = size;
+            __atomic_fetch_add(&s->live, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s->live_bytes, size, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+void profile_free(void *ptr)
+{
+    size_t slot = live_slot(ptr);
+    for (size_t i = 0; i < PROFILE_PROBES; i++)
+    {
+        struct prof_live *l = &live[(slot + i) & (PROFILE_LIVE - 1)];
+        void *p = __atomic_load_n(&l->ptr, __ATOMIC_ACQUIRE);
+        if (p == NULL)
+            return;
+        if (p != ptr)
+            continue;
+
+        struct prof_stack *s = &stacks[l->stack];
+        size_t size = l->size;
+        __atomic_store_n(&l->ptr, LIVE_FREED, __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&s->live, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&s->live_bytes, size, __ATOMIC_RELAXED);
+        return;
+    }
+}
+
+/**
+ * @brief Output buffer of a dump, stdio being off limits in a signal handler.
+ */
+struct out
+{
+    int fd; ///< File written to.
+    int failed; ///< Set once a write failed.
+    size_t len; ///< Bytes waiting in buf.
+    char buf[4096]; ///< Pending output.
+};
+
+static void out_flush(struct out *o)
+{
+    size_t done = 0;
+    while (done < o->len && !o->failed)
+    {
+        ssize_t n = write(o->fd, o->buf + done, o->len - done);
+        if (n <= 0)
+            o->failed = 1;
+        else
+            done += (size_t)n;
+    }
+    o->len = 0;
+}
+
+static void out_mem(struct out *o, const char *s, size_t len)
+{
+    while (len > 0)
+    {
+        if (o->len == sizeof(o->buf))
+            out_flush(o);
+        size_t n = sizeof(o->buf) - o->len;
+        if (n > len)
+            n = len;
+        memcpy(o->buf + o->len, s, n);
+        o->len += n;
+        s += n;
+        len -= n;
+    }
+}
+
+static void out_str(struct out *o, const char *s)
+{
+    out_mem(o, s, strlen(s));
+}
+
+static void out_num(struct out *o, uint64_t n, unsigned base)
+{
+    char tmp[24];
+    size_t i = sizeof(tmp);
+    do
+    {
+        tmp[--i] = "0123456789abcdef"[n % base];
+        n /= base;
+    } while (n != 0);
+    out_mem(o, tmp + i, sizeof(tmp) - i);
+}
+
+// One "live: bytes [allocs: bytes]" counts line
+static void out_counts(struct out *o, uint64_t live, uint64_t live_bytes,
+                       uint64_t allocs, uint64_t alloc_bytes)
+{
+    out_num(o, live, 10);
+    out_str(o, ": ");
+    out_num(o, live_bytes, 10);
+    out_str(o, " [");
+    out_num(o, allocs, 10);
+    out_str(o, ": ");
+    out_num(o, alloc_bytes, 10);
+    out_str(o, "] @");
+}
+
+int profile_dump(const char *path)
+{
+    if (!profile_active)
+        return -1;
+
+    // Static rather than on the stack of a possibly small signal stack, the
+    // sequence number in profile_dump_next keeps concurrent dumps rare
+    static struct out o;
+    o.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (o.fd < 0)
+        return -1;
+    o.failed = 0;
+    o.len = 0;
+
+    uint64_t total[4] = { 0 };
+    for (size_t i = 0; i < PROFILE_STACKS; i++)
+    {
+        struct prof_stack *s = &stacks[i];
+        if (__atomic_load_n(&s->hash, __ATOMIC_ACQUIRE) <= STACK_BUSY)
+            continue;
+        total[0] += __atomic_load_n(&s->live, __ATOMIC_RELAXED);
+        total[1] += __atomic_load_n(&s->live_bytes, __ATOMIC_RELAXED);
+        total[2] += __atomic_load_n(&s->allocs, __ATOMIC_RELAXED);
+        total[3] += __atomic_load_n(&s->alloc_bytes, __ATOMIC_RELAXED);
+    }
+
+    out_str(&o, "heap profile: ");
+    out_counts(&o, total[0], total[1], total[2], total[3]);
+    out_str(&o, " heap_v2/");
+    out_num(&o, rate, 10);
+    out_str(&o, "\n");
+
+    for (size_t i = 0; i < PROFILE_STACKS; i++)
+    {
+        struct prof_stack *s = &stacks[i];
+        if (__atomic_load_n(&s->hash, __ATOMIC_ACQUIRE) <= STACK_BUSY)
+            continue;
+
+        out_counts(&o, __atomic_load_n(&s->live, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->live_bytes, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->allocs, __ATOMIC_RELAXED),
+                   __atomic_load_n(&s->alloc_bytes, __ATOMIC_RELAXED));
+        for (int d = 0; d < s->depth; d++)
+        {
+            out_str(&o, " 0x");
+            out_num(&o, (uintptr_t)s->pc[d], 16);
+        }
+        out_str(&o, "\n");
+    }
+
+    // pprof symbolizes the addresses against these
+    out_str(&o, "\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0)
+    {
+        char buf[1024];
+        ssize_t n;
+        while ((n = read(maps, buf, sizeof(buf))) > 0)
+            out_mem(&o, buf, (size_t)n);
+        close(maps);
+    }
+
+    out_flush(&o);
+    int failed = o.failed;
+    if (close(o.fd) != 0)
+        failed = 1;
+    return failed ? -1 : 0;
+}
+
+void profile_dump_next(void)
+{
+    static struct out name;
+    unsigned seq = __atomic_fetch_add(&dump_seq, 1, __ATOMIC_RELAXED);
+
+    // Only the buffer is used, nothing is flushed
+    name.len = 0;
+    out_str(&name, prefix);
+    out_str(&name, ".");
+    out_num(&name, seq, 10);
+    out_str(&name, ".heap");
+    name.buf[name.len] = '\0';
+
+    profile_dump(name.buf);
+}
@@ -0,0 +1,93 @@
+#ifndef MY_PROFILE_H
+#define MY_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Deepest backtrace recorded for a sampled allocation.
+ */
+#define PROFILE_MAX_DEPTH 32
+
+/**
+ * @brief Distinct allocation sites kept, further sites are dropped.
+ */
+#define PROFILE_STACKS 4096
+
+/**
+ * @brief Sampled blocks tracked until their free, a power of two.
+ */
+#define PROFILE_LIVE 65536
+
+/**
+ * @brief Non-zero once profile_start succeeded. Only read on the free path,
+ * allocations find out through the interval returned by
+ * profile_next_interval.
+ */
+extern int profile_active;
+
+/**
+ * @brief Starts sampling about one allocation per rate bytes.
+ *
+ * Maps the tables the samples are kept in. Not thread-safe, meant to run
+ * once from the library constructor.
+ *
+ * @param rate Mean number of bytes allocated between two samples.
+ * @return 0 on success, -1 if rate is 0 or the tables cannot be mapped.
+ */
+int profile_start(size_t rate);
+
+/**
+ * @brief Reads TINYMALLOC_PROF_RATE, TINYMALLOC_PROF_PREFIX and
+ * TINYMALLOC_PROF_SIGNAL and starts the profiler if a rate is set.
+ */
+void profile_init(void);
+
+/**
+ * @brief Draws the number of bytes to allocate before the next sample.
+ *
+ * @return A random interval averaging the sampling rate, or INT64_MAX once
+ * profile_init left the profiler off.
+ */
+int64_t profile_next_interval(void);
+
+/**
+ * @brief Records a sampled allocation with the backtrace of its caller.
+ *
+ * Lock-free and safe to call from any thread. Allocations made while taking
+ * the backtrace are not sampled.
+ *
+ * @param ptr The block returned to the caller.
+ * @param size The requested size, in bytes.
+ */
+void profile_record(void *ptr, size_t size);
+
+/**
+ * @brief Forgets a block if it was sampled, moving it out of the live
+ * profile.
+ *
+ * @param ptr The block being freed.
+ */
+void profile_free(void *ptr);
+
+/**
+ * @brief Writes the live and cumulative profiles in the heap_v2 text format
+ * read by pprof, followed by the process mappings.
+ *
+ * Only uses async-signal-safe calls, so it may run from a signal handler.
+ *
+ * @param path File to create or truncate.
+ * @return 0 on success, -1 if the profiler is off or the file cannot be
+ * written.
+ */
+int profile_dump(const char *path);
+
+/**
+ * @brief Dumps to <prefix>.<sequence>.heap, the prefix coming from
+ * TINYMALLOC_PROF_PREFIX.
+ *
+ * Async-signal-safe like profile_dump.
+ */
+void profile_dump_next(void);
+
+#endif /* !MY_PROFILE_H */
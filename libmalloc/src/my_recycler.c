@@ -4,45 +4,51 @@
 #include <stdint.h>
 #include <stddef.h>
 
-static int recycler_owns_block(const struct recycler *r, const void *block)
+#define BITS_PER_WORD 64
+
+// Index of a block of the recycler, or capacity if the pointer is foreign or
+// misaligned
+static size_t block_index(const struct recycler *r, const void *block)
 {
     if (!r || !block || !r->chunk || r->block_size == 0 || r->capacity == 0)
-        return 0;
-
-    size_t span;
-    if (__builtin_mul_overflow(r->capacity, r->block_size, &span))
-        return 0;
+        return r ? r->capacity : 0;
 
     uintptr_t base = (uintptr_t)r->chunk;
     uintptr_t p    = (uintptr_t)block;
+    if (p < base)
+        return r->capacity;
 
-    // Prevent base + span overflow
-    if ((uintptr_t)span > UINTPTR_MAX - base)
-        return 0;
+    uintptr_t off = p - base;
+    size_t idx = (size_t)(off / (uintptr_t)r->block_size);
 
-    uintptr_t end = base + (uintptr_t)span;
+    // Must be aligned to block boundary
+    if (idx >= r->capacity || idx * r->block_size != off)
+        return r->capacity;
 
-    if (p < base || p >= end)
-        return 0;
+    return idx;
+}
 
-    // Must be aligned to block boundary
-    if (((p - base) % (uintptr_t)r->block_size) != 0)
-        return 0;
+// The allocation bitmap is only written under the lock, but remote freers
+// read it without it: every access is atomic, relaxed is enough
+static int bit_test(const struct recycler *r, size_t idx)
+{
+    uint64_t word =
+        __atomic_load_n(&r->bitmap[idx / BITS_PER_WORD], __ATOMIC_RELAXED);
+    return (word >> (idx % BITS_PER_WORD)) & 1;
+}
 
-    return 1;
+static void bit_flip(struct recycler *r, size_t idx)
+{
+    uint64_t *word = &r->bitmap[idx / BITS_PER_WORD];
+    uint64_t bits = __atomic_load_n(word, __ATOMIC_RELAXED);
+    __atomic_store_n(word, bits ^ ((uint64_t)1 << (idx % BITS_PER_WORD)),
+                     __ATOMIC_RELAXED);
 }
 
-static int freelist_contains(const struct recycler *r, const void *block)
+int recycler_owns_block(const struct recycler *r, const void *block)
 {
-    // Defensive scan capped by capacity to avoid infinite loops on corruption.
-    const struct free_list *cur = (const struct free_list *)r->free;
-    for (size_t i = 0; i < r->capacity && cur != NULL; i++)
-    {
-        if ((const void *)cur == block)
-            return 1;
-        cur = cur->next;
-    }
-    return 0;
+    size_t idx = block_index(r, block);
+    return r != NULL && idx < r->capacity && bit_test(r, idx);
 }
 
 void recycler_create(struct recycler **recycler_ptr,
@@ -59,7 +65,11 @@ void recycler_create(struct recycler **recycler_ptr,
     if (block_size == 0 || total_size == 0 || start_addr == NULL)
         goto fail;
 
-    if ((block_size % ALIGNMENT) != 0)
+    // Blocks are ALIGNMENT multiples, except the tiny class which only has to
+    // hold a free list link
+    if ((block_size % ALIGNMENT) != 0
+        && (block_size >= ALIGNMENT
+            || (block_size % sizeof(struct free_list)) != 0))
         goto fail;
 
     if (((uintptr_t)start_addr % ALIGNMENT) != 0)
@@ -69,47 +79,76 @@ void recycler_create(struct recycler **recycler_ptr,
     r->capacity   = total_size / block_size;
     r->chunk      = start_addr;
 
-    // Critical fix: capacity must be >= 1
-    if (r->capacity == 0)
-        goto fail;
+    // Blocks past the bitmap are left unused
+    if (r->capacity > RECYCLER_MAX_BLOCKS)
+        r->capacity = RECYCLER_MAX_BLOCKS;
 
-    // Build free list in-place
-    struct free_list *first = (struct free_list *)start_addr;
-    struct free_list *cur   = first;
-
-    for (size_t i = 1; i < r->capacity; i++)
+    for (size_t i = 0; i < RECYCLER_BITMAP_WORDS; i++)
     {
-        cur->next = (struct free_list *)((char *)cur + block_size);
-        cur = cur->next;
+        __atomic_store_n(&r->bitmap[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->remote_bitmap[i], 0, __ATOMIC_RELAXED);
     }
-    cur->next = NULL;
 
-    r->allocated = 0;
-    r->free      = (void *)first;
+    // Critical fix: capacity must be >= 1
+    if (r->capacity == 0)
+        goto fail;
+
+    // Blocks are carved lazily, so pages are only touched once used
+    r->allocated   = 0;
+    r->carved      = 0;
+    r->zero_from   = r->capacity;
+    r->free        = NULL;
+    r->owner       = 0;
+    r->remote      = 0;
+    r->remote_next = NULL;
+    r->class_index = 0;
     return;
 
 fail:
     // Ensure caller can detect failure
-    r->block_size = 0;
-    r->capacity   = 0;
-    r->allocated  = 0;
-    r->chunk      = NULL;
-    r->free       = NULL;
-    *recycler_ptr = NULL;
+    r->block_size  = 0;
+    r->capacity    = 0;
+    r->allocated   = 0;
+    r->carved      = 0;
+    r->zero_from   = 0;
+    r->chunk       = NULL;
+    r->free        = NULL;
+    r->owner       = 0;
+    r->remote      = 0;
+    r->remote_next = NULL;
+    r->class_index = 0;
+    *recycler_ptr  = NULL;
 }
 
 void *recycler_allocate(struct recycler *r)
 {
-    if (r == NULL || r->free == NULL)
+    if (r == NULL)
         return NULL;
 
     // Defensive: prevent overflow of allocated count beyond capacity
     if (r->allocated >= r->capacity)
         return NULL;
 
+    // Freed blocks first, they are already faulted in
+    if (r->free == NULL)
+    {
+        if (r->carved >= r->capacity)
+            return NULL;
+
+        size_t idx = r->carved++;
+        r->allocated++;
+        bit_flip(r, idx);
+        return (char *)r->chunk + idx * r->block_size;
+    }
+
     struct free_list *blk = (struct free_list *)r->free;
+    size_t idx = block_index(r, blk);
+    if (idx >= r->capacity || bit_test(r, idx))
+        return NULL; // corrupted free list
+
     r->free = (void *)blk->next;
     r->allocated++;
+    bit_flip(r, idx);
 
     return (void *)blk;
 }
@@ -124,15 +163,90 @@ void recycler_free(struct recycler *r, void *block)
         return;
 
     // Reject foreign/misaligned pointers (prevents arbitrary writes to "next")
-    if (!recycler_owns_block(r, block))
-        return;
-
-    // Reject double-free (prevents cycles/corruption)
-    if (freelist_contains(r, block))
+    // and double frees (prevents cycles/corruption) with one bit test
+    size_t idx = block_index(r, block);
+    if (idx >= r->capacity || !bit_test(r, idx))
         return;
 
     struct free_list *b = (struct free_list *)block;
     b->next = (struct free_list *)r->free;
     r->free = (void *)b;
     r->allocated--;
+    bit_flip(r, idx);
+}
+
+int recycler_remote_free(struct recycler *r, void *block)
+{
+    if (r == NULL || block == NULL)
+        return 0;
+
+    size_t idx = block_index(r, block);
+    if (idx >= r->capacity)
+        return 0;
+
+    // Claim the block for the remote list first: a second remote free of it
+    // sees the bit and goes no further. Only remote frees set it, so a block
+    // freed once through a cache and once remotely is not caught here.
+    uint64_t *word = &r->remote_bitmap[idx / BITS_PER_WORD];
+    uint64_t bit = (uint64_t)1 << (idx % BITS_PER_WORD);
+    if (__atomic_fetch_or(word, bit, __ATOMIC_ACQ_REL) & bit)
+        return 0;
+
+    // The collector clears the allocation bit before the remote one, so a
+    // block it took back reads as free here
+    if (!bit_test(r, idx))
+    {
+        __atomic_and_fetch(word, ~bit, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    struct free_list *b = (struct free_list *)block;
+    uintptr_t old = __atomic_load_n(&r->remote, __ATOMIC_RELAXED);
+    do
+    {
+        b->next = (struct free_list *)(old & ~REMOTE_PENDING);
+    } while (!__atomic_compare_exchange_n(&r->remote, &old,
+                                          (uintptr_t)b | REMOTE_PENDING, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return (old & REMOTE_PENDING) == 0;
+}
+
+size_t recycler_collect(struct recycler *r, int clear_pending)
+{
+    if (r == NULL)
+        return 0;
+
+    uintptr_t old = __atomic_load_n(&r->remote, __ATOMIC_RELAXED);
+    uintptr_t keep;
+    do
+    {
+        keep = clear_pending ? 0 : (old & REMOTE_PENDING);
+        if (old == keep)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&r->remote, &old, keep, 1,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    // Capped by the allocated count, in case a use after free overwrote a
+    // link
+    struct free_list *cur = (struct free_list *)(old & ~REMOTE_PENDING);
+    size_t budget = r->allocated;
+    size_t count = 0;
+    while (cur != NULL && budget-- > 0)
+    {
+        struct free_list *next = cur->next;
+        size_t before = r->allocated;
+        size_t idx = block_index(r, cur);
+        recycler_free(r, cur);
+        count += before - r->allocated;
+
+        // Only now may the block be freed remotely again
+        if (idx < r->capacity)
+            __atomic_and_fetch(&r->remote_bitmap[idx / BITS_PER_WORD],
+                               ~((uint64_t)1 << (idx % BITS_PER_WORD)),
+                               __ATOMIC_RELEASE);
+        cur = next;
+    }
+
+    return count;
 }
@@ -2,6 +2,25 @@
 #define RECYCLER_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Low bit of recycler::remote, set while the page has to be handed to
+ * the collector. Blocks are at least 16-byte aligned so the bit is free.
+ */
+#define REMOTE_PENDING ((uintptr_t)1)
+
+/**
+ * @brief Most blocks a recycler manages, one bit each in its allocation
+ * bitmap. Enough for the smallest class in a 4 KiB page.
+ */
+#ifdef MY_TINY_CLASS
+#    define RECYCLER_MAX_BLOCKS 512
+#else
+#    define RECYCLER_MAX_BLOCKS 256
+#endif
+
+#define RECYCLER_BITMAP_WORDS (RECYCLER_MAX_BLOCKS / 64)
 
 /**
  * @brief Structure representing a memory recycler.
@@ -12,9 +31,19 @@ struct recycler
     size_t block_size; ///< Size of each memory block within the recycler.
     size_t allocated; ///< Number of blocks currently allocated.
     size_t capacity; ///< Total number of blocks that can be allocated.
+    size_t carved; ///< Blocks handed out by the bump pointer, in order.
+    size_t zero_from; ///< First block known to be zero until it is carved.
     void
         *chunk; ///< Pointer to the start of the memory managed by the recycler.
-    void *free; ///< Pointer to the list of free blocks.
+    void *free; ///< Pointer to the list of freed blocks.
+    uintptr_t owner; ///< Thread cache refilled from this page, 0 if shared.
+    uintptr_t remote; ///< Blocks freed by other threads, | REMOTE_PENDING.
+    struct recycler *remote_next; ///< Next page waiting for the collector.
+    size_t class_index; ///< Size class of the blocks, set by the page's owner.
+    size_t node; ///< NUMA node of the pages, whose arena the page is in.
+    uint64_t bitmap[RECYCLER_BITMAP_WORDS]; ///< Set bit per allocated block.
+    uint64_t remote_bitmap[RECYCLER_BITMAP_WORDS]; ///< Set bit per block on
+                                                   ///< the remote list.
 };
 
 /**
@@ -36,6 +65,39 @@ struct free_list
 void recycler_create(struct recycler **ret, size_t block_size,
                      size_t total_size, void *start_point);
 
+/**
+ * @brief Tells whether a pointer is a block currently allocated from the
+ * recycler, in constant time.
+ *
+ * @param r Pointer to the recycler.
+ * @param block Pointer to test.
+ * @return 1 if block is an allocated block of r, 0 otherwise.
+ */
+int recycler_owns_block(const struct recycler *r, const void *block);
+
+/**
+ * @brief Tells whether a recycler has no block left to allocate.
+ *
+ * @param r Pointer to the recycler.
+ * @return 1 if neither the free list nor the bump pointer has a block.
+ */
+static inline int recycler_full(const struct recycler *r)
+{
+    return r->free == NULL && r->carved >= r->capacity;
+}
+
+/**
+ * @brief Tells whether the next block recycler_allocate returns is known to
+ * be zero-filled, that is carved at or past zero_from.
+ *
+ * @param r Pointer to the recycler.
+ * @return 1 if the next block is zero-filled, 0 if unknown.
+ */
+static inline int recycler_next_zeroed(const struct recycler *r)
+{
+    return r->free == NULL && r->carved >= r->zero_from;
+}
+
 /**
  * @brief Allocates a block of memory from the recycler.
  *
@@ -52,4 +114,32 @@ void *recycler_allocate(struct recycler *r);
  */
 void recycler_free(struct recycler *r, void *block);
 
+/**
+ * @brief Pushes a block onto the remote free list of a recycler.
+ *
+ * Lock-free and callable from any thread. The block stays accounted as
+ * allocated until it is collected. Blocks that are not allocated, or already
+ * on the remote list, are dropped, so two remote frees of a block cannot link
+ * it twice. A block also freed through a cache is not detected.
+ *
+ * @param r Pointer to the recycler owning the block.
+ * @param block Pointer to the block being freed.
+ * @return 1 if this push set REMOTE_PENDING, in which case the caller must
+ * hand the page to the collector, 0 otherwise or if the block was dropped.
+ */
+int recycler_remote_free(struct recycler *r, void *block);
+
+/**
+ * @brief Moves the remote free list of a recycler into its free list.
+ *
+ * Must be called with the allocator lock held. Each block goes through the
+ * same checks as recycler_free.
+ *
+ * @param r Pointer to the recycler.
+ * @param clear_pending Non-zero to also clear REMOTE_PENDING, which only the
+ * collector that received the page may do.
+ * @return The number of blocks collected.
+ */
+size_t recycler_collect(struct recycler *r, int clear_pending);
+
 #endif /* !RECYCLER_H */
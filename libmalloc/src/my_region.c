@@ -0,0 +1,151 @@
+#include "my_region.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "my_malloc.h"
+#include "my_numa.h"
+#include "page_pool.h"
+#include "tools.h"
+
+// Bytes of the chunks of all regions, updated under the lock
+static size_t mapped;
+
+// Chunks only hold a blk_meta, the payload starts right after it
+static size_t chunk_header(void)
+{
+    return size_align(sizeof(struct blk_meta));
+}
+
+static char *chunk_end(struct blk_meta *m)
+{
+    return (char *)m + m->size;
+}
+
+// Maps a chunk with at least payload bytes after its header, a regular one
+// of the region's length if that is enough. Chunks come from the page pool
+// of the node when it has one, and go back to it, so that regions and size
+// classes reuse each other's mappings.
+static struct blk_meta *map_chunk(size_t payload, size_t chunk_size,
+                                  size_t node)
+{
+    size_t hdr = chunk_header();
+    if (payload > SIZE_MAX - hdr)
+        return NULL;
+
+    size_t len = blka_map_size(payload + hdr < chunk_size ? chunk_size
+                                                          : payload + hdr);
+    if (len == 0)
+        return NULL;
+
+    size_t zero = 0;
+    struct blk_meta *m = pool_take(&len, &zero, node);
+    if (m == NULL)
+    {
+        my_enforce_budget(len);
+        m = blka_map(len);
+        if (m == NULL)
+            return NULL;
+        numa_bind(m, len, node);
+    }
+
+    m->size = len;
+    mapped += len;
+    return m;
+}
+
+static void unmap_chunk(struct blk_meta *m, size_t node)
+{
+    mapped -= m->size;
+    pool_put(m, m->size, node);
+}
+
+static void push_chunk(struct region *r, struct blk_meta *m)
+{
+    m->prev = NULL;
+    m->next = r->chunks.meta;
+    if (r->chunks.meta)
+        r->chunks.meta->prev = m;
+    r->chunks.meta = m;
+
+    r->top = (char *)m + chunk_header();
+    r->end = chunk_end(m);
+}
+
+struct region *region_create(size_t chunk_size)
+{
+    if (chunk_size == 0)
+        chunk_size = REGION_CHUNK_SIZE;
+
+    size_t node = numa_node();
+    size_t self = size_align(sizeof(struct region));
+    struct blk_meta *m = map_chunk(self, chunk_size, node);
+    if (m == NULL)
+        return NULL;
+
+    struct region *r = (struct region *)((char *)m + chunk_header());
+    r->chunks.meta = NULL;
+    r->chunk_size = chunk_size;
+    r->node = node;
+    push_chunk(r, m);
+    r->top += self;
+    return r;
+}
+
+int region_grow(struct region *r, size_t size)
+{
+    size_t payload = size_align(size);
+    if (payload == 0 && size != 0)
+        return -1;
+
+    struct blk_meta *m = map_chunk(payload, r->chunk_size, r->node);
+    if (m == NULL)
+        return -1;
+
+    push_chunk(r, m);
+    return 0;
+}
+
+struct region_mark region_mark(const struct region *r)
+{
+    struct region_mark mark = { r->chunks.meta, r->top };
+    return mark;
+}
+
+void region_reset(struct region *r, struct region_mark mark)
+{
+    // Chunks newer than the mark's are at the head of the list, the first
+    // chunk holds the region and is never released
+    while (r->chunks.meta != mark.chunk && r->chunks.meta->next != NULL)
+    {
+        struct blk_meta *m = r->chunks.meta;
+        r->chunks.meta = m->next;
+        r->chunks.meta->prev = NULL;
+        unmap_chunk(m, r->node);
+    }
+
+    // A stale mark, whose chunk is gone, empties the region
+    if (r->chunks.meta == mark.chunk)
+        r->top = mark.top;
+    else
+        r->top = (char *)r + size_align(sizeof(struct region));
+    r->end = chunk_end(r->chunks.meta);
+}
+
+void region_destroy(struct region *r)
+{
+    // The region is in the last chunk, read the links before releasing it
+    size_t node = r->node;
+    struct blk_meta *m = r->chunks.meta;
+    while (m != NULL)
+    {
+        struct blk_meta *next = m->next;
+        unmap_chunk(m, node);
+        m = next;
+    }
+}
+
+size_t region_bytes(void)
+{
+    return mapped;
+}
@@ -0,0 +1,123 @@
+#ifndef MY_REGION_H
+#define MY_REGION_H
+
+#include <stddef.h>
+
+#include "blk_allocator.h"
+#include "tools.h"
+
+/**
+ * @brief Default mapping length of the chunks of a region, in bytes.
+ */
+#ifndef REGION_CHUNK_SIZE
+#    define REGION_CHUNK_SIZE (64 * 1024)
+#endif
+
+/**
+ * @brief A bump allocator over a list of chunks, released all at once.
+ *
+ * The region lives at the start of its first chunk. It is not thread-safe:
+ * each region is used by one thread at a time.
+ */
+struct region
+{
+    struct blk_allocator chunks; ///< Chunks, newest first, the last one
+                                 ///< holding the region itself.
+    char *top; ///< Next free byte of the newest chunk.
+    char *end; ///< End of the newest chunk.
+    size_t chunk_size; ///< Mapping length of a regular chunk, in bytes.
+    size_t node; ///< NUMA node the chunks are taken from.
+};
+
+/**
+ * @brief A position in a region, to rewind it to.
+ */
+struct region_mark
+{
+    struct blk_meta *chunk; ///< Newest chunk when the mark was taken.
+    char *top; ///< Its next free byte at the time.
+};
+
+/**
+ * @brief Creates a region in a chunk of its own.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param chunk_size Mapping length of a regular chunk, 0 for
+ * REGION_CHUNK_SIZE. Blocks that do not fit get a longer chunk.
+ * @return The region, or NULL if no chunk can be mapped.
+ */
+struct region *region_create(size_t chunk_size);
+
+/**
+ * @brief Carves a block from the newest chunk of a region.
+ *
+ * Does not need the allocator lock.
+ *
+ * @param r The region.
+ * @param size The size of the block, in bytes.
+ * @return A block aligned to ALIGNMENT, or NULL if the chunk is too short,
+ * in which case region_grow must be called first.
+ */
+static inline void *region_alloc(struct region *r, size_t size)
+{
+    size_t aligned = (size + (ALIGNMENT - 1)) & ~(size_t)(ALIGNMENT - 1);
+    if (aligned < size || aligned > (size_t)(r->end - r->top))
+        return NULL;
+
+    void *p = r->top;
+    r->top += aligned;
+    return p;
+}
+
+/**
+ * @brief Adds a chunk holding at least size bytes, which becomes the newest
+ * one. The room left in the previous chunk is not used any more.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param r The region.
+ * @param size The size of the block that did not fit, in bytes.
+ * @return 0 on success, -1 if no chunk can be mapped.
+ */
+int region_grow(struct region *r, size_t size);
+
+/**
+ * @brief Returns the current position of a region.
+ *
+ * @param r The region.
+ * @return A mark for region_reset.
+ */
+struct region_mark region_mark(const struct region *r);
+
+/**
+ * @brief Rewinds a region to a mark, releasing the chunks added since in
+ * constant time each.
+ *
+ * Must be called with the allocator lock held, unless the mark is in the
+ * newest chunk and nothing is released. Marks taken after this one
+ * become invalid, and rewinding to a mark whose chunk was released empties
+ * the region.
+ *
+ * @param r The region.
+ * @param mark A mark of the region, taken since its last rewind before it.
+ */
+void region_reset(struct region *r, struct region_mark mark);
+
+/**
+ * @brief Releases every chunk of a region, the region included.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param r The region.
+ */
+void region_destroy(struct region *r);
+
+/**
+ * @brief Returns the bytes of the chunks of every region.
+ *
+ * Must be called with the allocator lock held.
+ */
+size_t region_bytes(void);
+
+#endif /* !MY_REGION_H */
@@ -0,0 +1,74 @@
+#include "my_stats.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Threads whose counters are attached, and the sums of those that exited
+static struct stats_counters *attached;
+static struct stats_counters retired;
+
+// Threads counting before their cache is set up, or after it is gone
+static struct stats_counters shared;
+
+void stats_count_malloc_shared(size_t index, size_t size, size_t block_size)
+{
+    __atomic_fetch_add(&shared.mallocs[index], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shared.requested[index], size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shared.allocated[index], block_size, __ATOMIC_RELAXED);
+}
+
+void stats_count_free_shared(size_t index)
+{
+    __atomic_fetch_add(&shared.frees[index], 1, __ATOMIC_RELAXED);
+}
+
+static void add_counters(struct stats_counters *sum,
+                         const struct stats_counters *c)
+{
+    for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+    {
+        sum->mallocs[i] += __atomic_load_n(&c->mallocs[i], __ATOMIC_RELAXED);
+        sum->frees[i] += __atomic_load_n(&c->frees[i], __ATOMIC_RELAXED);
+        sum->requested[i] +=
+            __atomic_load_n(&c->requested[i], __ATOMIC_RELAXED);
+        sum->allocated[i] +=
+            __atomic_load_n(&c->allocated[i], __ATOMIC_RELAXED);
+    }
+}
+
+void stats_attach(struct stats_counters *c)
+{
+    c->prev = NULL;
+    c->next = attached;
+    if (attached)
+        attached->prev = c;
+    attached = c;
+}
+
+void stats_detach(struct stats_counters *c)
+{
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        attached = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+
+    add_counters(&retired, c);
+}
+
+void stats_read(struct stats_counters *sum)
+{
+    for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+    {
+        sum->mallocs[i] = 0;
+        sum->frees[i] = 0;
+        sum->requested[i] = 0;
+        sum->allocated[i] = 0;
+    }
+
+    add_counters(sum, &retired);
+    add_counters(sum, &shared);
+    for (struct stats_counters *c = attached; c != NULL; c = c->next)
+        add_counters(sum, c);
+}
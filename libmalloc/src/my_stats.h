@@ -0,0 +1,123 @@
+#ifndef MY_STATS_H
+#define MY_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "my_malloc.h"
+
+/**
+ * @brief Number of counted classes, the last one being the large bucket.
+ */
+#define STATS_CLASS_COUNT (BUCKET_COUNT + 1)
+
+/**
+ * @brief Allocation counters of one thread.
+ *
+ * Only the owning thread writes them, with plain relaxed stores, so counting
+ * costs no atomic operation. stats_read sums every attached thread under the
+ * allocator lock.
+ */
+struct stats_counters
+{
+    uint64_t mallocs[STATS_CLASS_COUNT]; ///< Blocks handed out.
+    uint64_t frees[STATS_CLASS_COUNT]; ///< Blocks given back.
+    uint64_t requested[STATS_CLASS_COUNT]; ///< Bytes asked for.
+    uint64_t allocated[STATS_CLASS_COUNT]; ///< Bytes of the blocks handed out.
+    struct stats_counters *next; ///< Next attached thread.
+    struct stats_counters *prev; ///< Previous attached thread.
+};
+
+/**
+ * @brief Counts an allocation atomically, in the counters shared by the
+ * threads without their own.
+ *
+ * @param index The class index, BUCKET_COUNT for a large block.
+ * @param size The requested size, in bytes.
+ * @param block_size The size of the block handed out, in bytes.
+ */
+void stats_count_malloc_shared(size_t index, size_t size, size_t block_size);
+
+/**
+ * @brief Counts a free atomically, in the shared counters.
+ *
+ * @param index The class index, BUCKET_COUNT for a large block.
+ */
+void stats_count_free_shared(size_t index);
+
+// Single writer: a relaxed load and store, never a locked instruction
+static inline void stats_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts an allocation.
+ *
+ * @param c Counters of the calling thread, or NULL for the shared ones.
+ * @param index The class index, BUCKET_COUNT for a large block.
+ * @param size The requested size, in bytes.
+ * @param block_size The size of the block handed out, in bytes.
+ */
+static inline void stats_count_malloc(struct stats_counters *c, size_t index,
+                                      size_t size, size_t block_size)
+{
+    if (c == NULL)
+    {
+        stats_count_malloc_shared(index, size, block_size);
+        return;
+    }
+
+    stats_add(&c->mallocs[index], 1);
+    stats_add(&c->requested[index], size);
+    stats_add(&c->allocated[index], block_size);
+}
+
+/**
+ * @brief Counts a free.
+ *
+ * @param c Counters of the calling thread, or NULL for the shared ones.
+ * @param index The class index, BUCKET_COUNT for a large block.
+ */
+static inline void stats_count_free(struct stats_counters *c, size_t index)
+{
+    if (c == NULL)
+    {
+        stats_count_free_shared(index);
+        return;
+    }
+
+    stats_add(&c->frees[index], 1);
+}
+
+/**
+ * @brief Adds the counters of a thread to those summed by stats_read.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param c Zeroed counters of the calling thread.
+ */
+void stats_attach(struct stats_counters *c);
+
+/**
+ * @brief Removes the counters of an exiting thread, folding them into the
+ * counters kept for the threads that are gone.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param c Counters previously given to stats_attach.
+ */
+void stats_detach(struct stats_counters *c);
+
+/**
+ * @brief Sums the counters of every thread, past and present.
+ *
+ * Must be called with the allocator lock held. Counters of running threads
+ * are read racily and may lag by a few operations.
+ *
+ * @param sum Receives the sums, its links are left unset.
+ */
+void stats_read(struct stats_counters *sum);
+
+#endif /* !MY_STATS_H */
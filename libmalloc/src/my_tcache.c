@@ -0,0 +1,125 @@
+#include "my_tcache.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "my_conf.h"
+
+static void bin_push(struct tcache *tc, size_t index, void *ptr)
+{
+    struct tcache_bin *bin = &tc->bins[index];
+    struct free_list *blk = (struct free_list *)ptr;
+    blk->next = bin->head;
+    if (tcache_tagged(index))
+        ((uintptr_t *)blk)[1] = tc->key;
+    bin->head = blk;
+    bin->count++;
+}
+
+static int bin_contains(const struct tcache_bin *bin, const void *ptr)
+{
+    // Capped by count so a corrupted bin cannot loop forever
+    const struct free_list *cur = bin->head;
+    for (size_t i = 0; i < bin->count && cur != NULL; i++)
+    {
+        if ((const void *)cur == ptr)
+            return 1;
+        cur = cur->next;
+    }
+    return 0;
+}
+
+void tcache_init(struct tcache *tc)
+{
+    for (size_t i = 0; i < CACHE_CLASS_COUNT; i++)
+    {
+        size_t limit = conf.tcache_bytes / my_class_size(i);
+        if (limit > conf.tcache_max)
+            limit = conf.tcache_max;
+        if (limit < conf.tcache_min)
+            limit = conf.tcache_min;
+
+        tc->bins[i].head = NULL;
+        tc->bins[i].count = 0;
+        tc->bins[i].limit = limit;
+    }
+
+    // Unique per live thread, and never a valid block address
+    tc->key = (uintptr_t)tc | 1;
+}
+
+int tcache_free(struct tcache *tc, size_t index, void *ptr)
+{
+    struct tcache_bin *bin = &tc->bins[index];
+
+    if (tcache_tagged(index) && ((uintptr_t *)ptr)[1] == tc->key
+        && bin_contains(bin, ptr))
+        return 1; // double free, drop it
+
+    if (bin->count >= bin->limit)
+        return 0;
+
+    bin_push(tc, index, ptr);
+    return 1;
+}
+
+size_t tcache_refill(struct tcache *tc, size_t index)
+{
+    struct tcache_bin *bin = &tc->bins[index];
+    void *batch[TCACHE_MAX_COUNT];
+
+    size_t want = bin->limit / 2;
+    if (bin->count + want > bin->limit)
+        want = bin->limit - bin->count;
+
+    size_t got = my_malloc_batch(index, batch, want, (uintptr_t)tc);
+    for (size_t i = got; i > 0; i--)
+        bin_push(tc, index, batch[i - 1]);
+
+    return got;
+}
+
+void tcache_flush(struct tcache *tc, size_t index)
+{
+    struct tcache_bin *bin = &tc->bins[index];
+    size_t keep = bin->count / 2;
+
+    // The most recently freed blocks sit at the head and are the hottest
+    struct free_list *cur = bin->head;
+    struct free_list *last = NULL;
+    for (size_t i = 0; i < keep && cur != NULL; i++)
+    {
+        last = cur;
+        cur = cur->next;
+    }
+
+    if (last == NULL)
+        bin->head = NULL;
+    else
+        last->next = NULL;
+    bin->count = keep;
+
+    while (cur != NULL)
+    {
+        struct free_list *next = cur->next;
+        my_free(cur);
+        cur = next;
+    }
+}
+
+void tcache_destroy(struct tcache *tc)
+{
+    for (size_t i = 0; i < CACHE_CLASS_COUNT; i++)
+    {
+        struct free_list *cur = tc->bins[i].head;
+        tc->bins[i].head = NULL;
+        tc->bins[i].count = 0;
+
+        while (cur != NULL)
+        {
+            struct free_list *next = cur->next;
+            my_free(cur);
+            cur = next;
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef MY_TCACHE_H
+#define MY_TCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "my_malloc.h"
+#include "my_recycler.h"
+
+/**
+ * @brief Upper bound on the number of blocks cached per size class.
+ */
+#define TCACHE_MAX_COUNT 64
+
+/**
+ * @brief Lower bound on the number of blocks cached per size class.
+ */
+#define TCACHE_MIN_COUNT 8
+
+/**
+ * @brief Byte budget of a single size class bin, converted to a block count.
+ */
+#define TCACHE_BIN_BYTES (16 * 1024)
+
+/**
+ * @brief Per-size-class stack of cached free blocks.
+ */
+struct tcache_bin
+{
+    struct free_list *head; ///< Most recently cached block.
+    size_t count; ///< Number of blocks in the bin.
+    size_t limit; ///< Maximum number of blocks kept before flushing.
+};
+
+/**
+ * @brief Per-thread cache of free blocks, one bin per cached size class.
+ *
+ * Bins are only ever touched by their owning thread, so pushes and pops need
+ * no atomic operation. Refills and flushes move half a bin at a time from and
+ * to the shared pages and must run under the allocator lock.
+ */
+struct tcache
+{
+    struct tcache_bin bins[CACHE_CLASS_COUNT]; ///< One bin per cached class.
+    uintptr_t key; ///< Tag written into cached blocks to catch double frees.
+};
+
+/**
+ * @brief Initializes an empty thread cache.
+ *
+ * @param tc Pointer to the cache to initialize.
+ */
+void tcache_init(struct tcache *tc);
+
+/**
+ * @brief Tells whether blocks of a class have room for the double free tag
+ * after their free list link.
+ *
+ * @param index The class index.
+ * @return 1 if cached blocks of the class are tagged, 0 otherwise.
+ */
+static inline int tcache_tagged(size_t index)
+{
+    return TINY_CLASS_COUNT == 0 || index != 0;
+}
+
+/**
+ * @brief Pops a cached block of a size class.
+ *
+ * @param tc Pointer to the cache.
+ * @param index The class index, must be lower than CACHE_CLASS_COUNT.
+ * @return A block, or NULL if the bin is empty and must be refilled.
+ */
+static inline void *tcache_alloc(struct tcache *tc, size_t index)
+{
+    struct tcache_bin *bin = &tc->bins[index];
+    struct free_list *blk = bin->head;
+    if (blk == NULL)
+        return NULL;
+
+    bin->head = blk->next;
+    bin->count--;
+    if (tcache_tagged(index))
+        ((uintptr_t *)blk)[1] = 0;
+    return blk;
+}
+
+/**
+ * @brief Pushes a block back into its size class bin.
+ *
+ * A block already tagged with the cache key is looked up in the bin and
+ * silently dropped if it is already there.
+ *
+ * @param tc Pointer to the cache.
+ * @param index The class index of the block.
+ * @param ptr The block to cache.
+ * @return 1 if the block was consumed, 0 if the bin is full and must be
+ * flushed first.
+ */
+int tcache_free(struct tcache *tc, size_t index, void *ptr);
+
+/**
+ * @brief Refills an empty bin with half its limit from the shared pages.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param tc Pointer to the cache.
+ * @param index The class index to refill.
+ * @return The number of blocks added to the bin.
+ */
+size_t tcache_refill(struct tcache *tc, size_t index);
+
+/**
+ * @brief Returns the oldest half of a bin to the shared pages.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param tc Pointer to the cache.
+ * @param index The class index to flush.
+ */
+void tcache_flush(struct tcache *tc, size_t index);
+
+/**
+ * @brief Returns every cached block to the shared pages.
+ *
+ * Must be called with the allocator lock held. The cache is left empty and can
+ * be reused.
+ *
+ * @param tc Pointer to the cache.
+ */
+void tcache_destroy(struct tcache *tc);
+
+#endif /* !MY_TCACHE_H */
@@ -0,0 +1,97 @@
+#include "page_map.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define PM_ROOT_SIZE ((size_t)1 << PM_ROOT_BITS)
+#define PM_LEAF_SIZE ((size_t)1 << PM_LEAF_BITS)
+
+// Zero-filled on demand, only the slots of used address ranges are touched
+static struct blk_meta **pm_root[PM_ROOT_SIZE];
+
+static struct blk_meta **leaf_for(uintptr_t page, int create)
+{
+    size_t i = page >> PM_LEAF_BITS;
+    struct blk_meta **leaf = __atomic_load_n(&pm_root[i], __ATOMIC_ACQUIRE);
+    if (leaf != NULL || !create)
+        return leaf;
+
+    void *m = mmap(NULL, PM_LEAF_SIZE * sizeof(struct blk_meta *),
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m == MAP_FAILED)
+        return NULL;
+
+    leaf = (struct blk_meta **)m;
+    __atomic_store_n(&pm_root[i], leaf, __ATOMIC_RELEASE);
+    return leaf;
+}
+
+static int in_range(uintptr_t addr)
+{
+#if PM_ADDR_BITS < __SIZEOF_POINTER__ * 8
+    return (addr >> PM_ADDR_BITS) == 0;
+#else
+    (void)addr;
+    return 1;
+#endif
+}
+
+int pagemap_set(void *addr, size_t len, struct blk_meta *meta)
+{
+    uintptr_t start = (uintptr_t)addr;
+    if (len == 0 || !in_range(start) || !in_range(start + len - 1))
+        return -1;
+
+    uintptr_t first = start >> PM_SHIFT;
+    uintptr_t last = (start + len - 1) >> PM_SHIFT;
+
+    for (uintptr_t page = first; page <= last; page++)
+    {
+        struct blk_meta **leaf = leaf_for(page, 1);
+        if (leaf == NULL)
+        {
+            if (page > first)
+                pagemap_clear(addr, (page - first) << PM_SHIFT);
+            return -1;
+        }
+
+        __atomic_store_n(&leaf[page & (PM_LEAF_SIZE - 1)], meta,
+                         __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+void pagemap_clear(void *addr, size_t len)
+{
+    uintptr_t start = (uintptr_t)addr;
+    if (len == 0 || !in_range(start) || !in_range(start + len - 1))
+        return;
+
+    uintptr_t first = start >> PM_SHIFT;
+    uintptr_t last = (start + len - 1) >> PM_SHIFT;
+
+    for (uintptr_t page = first; page <= last; page++)
+    {
+        struct blk_meta **leaf = leaf_for(page, 0);
+        if (leaf != NULL)
+            __atomic_store_n(&leaf[page & (PM_LEAF_SIZE - 1)], NULL,
+                             __ATOMIC_RELAXED);
+    }
+}
+
+struct blk_meta *pagemap_get(const void *addr)
+{
+    uintptr_t a = (uintptr_t)addr;
+    if (!in_range(a))
+        return NULL;
+
+    uintptr_t page = a >> PM_SHIFT;
+    struct blk_meta **leaf = leaf_for(page, 0);
+    if (leaf == NULL)
+        return NULL;
+
+    return __atomic_load_n(&leaf[page & (PM_LEAF_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,59 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include <stddef.h>
+
+#include "blk_allocator.h"
+
+/**
+ * @brief Granularity of the page map, independent of the system page size.
+ */
+#define PM_SHIFT 12
+
+/**
+ * @brief Number of address bits covered by the page map.
+ */
+#if __SIZEOF_POINTER__ == 8
+#    define PM_ADDR_BITS 48
+#else
+#    define PM_ADDR_BITS 32
+#endif
+
+#define PM_BITS (PM_ADDR_BITS - PM_SHIFT)
+#define PM_ROOT_BITS (PM_BITS / 2)
+#define PM_LEAF_BITS (PM_BITS - PM_ROOT_BITS)
+
+/**
+ * @brief Records that the granules of [addr, addr + len) belong to a mapping.
+ *
+ * Must be called with the allocator lock held. Leaves of the map are mapped on
+ * demand and never released.
+ *
+ * @param addr Start of the range, aligned to 1 << PM_SHIFT.
+ * @param len Length of the range in bytes.
+ * @param meta The mapping owning the range.
+ * @return 0 on success, -1 if a leaf could not be mapped.
+ */
+int pagemap_set(void *addr, size_t len, struct blk_meta *meta);
+
+/**
+ * @brief Forgets the granules of [addr, addr + len).
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param addr Start of the range, aligned to 1 << PM_SHIFT.
+ * @param len Length of the range in bytes.
+ */
+void pagemap_clear(void *addr, size_t len);
+
+/**
+ * @brief Returns the mapping owning the granule of an address.
+ *
+ * Lock-free, two dependent loads.
+ *
+ * @param addr Any address.
+ * @return The owning mapping, or NULL if the address is not ours.
+ */
+struct blk_meta *pagemap_get(const void *addr);
+
+#endif /* !PAGE_MAP_H */
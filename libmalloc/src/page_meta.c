@@ -0,0 +1,65 @@
+#include "page_meta.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "my_recycler.h"
+
+#define CACHE_LINE 64
+
+// A blk_meta and its recycler, rounded to whole cache lines
+#define META_SIZE                                                              \
+    ((sizeof(struct blk_meta) + sizeof(struct recycler) + CACHE_LINE - 1)      \
+     & ~(size_t)(CACHE_LINE - 1))
+
+/**
+ * @brief A header given back, linked through its first bytes.
+ */
+struct meta_free
+{
+    struct meta_free *next; ///< Next free header.
+};
+
+static struct meta_free *free_headers;
+static char *slab_next;
+static char *slab_end;
+static size_t slab_bytes;
+
+struct blk_meta *meta_alloc(void)
+{
+    if (free_headers != NULL)
+    {
+        struct meta_free *f = free_headers;
+        free_headers = f->next;
+        return (struct blk_meta *)f;
+    }
+
+    if ((size_t)(slab_end - slab_next) < META_SIZE)
+    {
+        void *slab = mmap(NULL, META_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED)
+            return NULL;
+
+        slab_next = slab;
+        slab_end = slab_next + META_SLAB_SIZE;
+        slab_bytes += META_SLAB_SIZE;
+    }
+
+    struct blk_meta *m = (struct blk_meta *)slab_next;
+    slab_next += META_SIZE;
+    return m;
+}
+
+void meta_free(struct blk_meta *m)
+{
+    struct meta_free *f = (struct meta_free *)m;
+    f->next = free_headers;
+    free_headers = f;
+}
+
+size_t meta_bytes(void)
+{
+    return slab_bytes;
+}
@@ -0,0 +1,40 @@
+#ifndef PAGE_META_H
+#define PAGE_META_H
+
+#include <stddef.h>
+
+#include "blk_allocator.h"
+
+/**
+ * @brief Bytes of the slabs the headers are packed in.
+ */
+#define META_SLAB_SIZE (64 * 1024)
+
+/**
+ * @brief Allocates the header of a span or large mapping: a blk_meta followed
+ * by its recycler, cache-line aligned, out of the mapping itself.
+ *
+ * Headers are packed in slabs of their own, so they never share a cache line
+ * or a page with user blocks. Must be called with the allocator lock held.
+ *
+ * @return The header, its content undefined, or NULL if out of memory.
+ */
+struct blk_meta *meta_alloc(void);
+
+/**
+ * @brief Gives a header back for reuse.
+ *
+ * Must be called with the allocator lock held.
+ *
+ * @param m A header returned by meta_alloc.
+ */
+void meta_free(struct blk_meta *m);
+
+/**
+ * @brief Returns the bytes of the slabs mapped for headers.
+ *
+ * Must be called with the allocator lock held.
+ */
+size_t meta_bytes(void);
+
+#endif /* !PAGE_META_H */
@@ -0,0 +1,343 @@
+#include "page_pool.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "my_conf.h"
+#include "my_numa.h"
+#include "tools.h"
+
+// Pages purged with MADV_FREE keep their contents until the kernel reclaims
+// them, with MADV_DONTNEED they read back as zero
+#ifdef MADV_FREE
+#    define POOL_PURGE_ADVICE MADV_FREE
+#    define POOL_PURGE_ZEROES 0
+#else
+#    define POOL_PURGE_ADVICE MADV_DONTNEED
+#    define POOL_PURGE_ZEROES 1
+#endif
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#    define POOL_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#    define POOL_CLOCK CLOCK_MONOTONIC
+#endif
+
+/**
+ * @brief Header of a pooled span, written over the start of the empty
+ * mapping.
+ */
+struct pool_span
+{
+    struct blk_meta meta; ///< Links of the size bin and mapping length.
+    struct pool_span *older; ///< Next span towards the oldest one.
+    struct pool_span *newer; ///< Next span towards the newest one.
+    uint64_t since; ///< Time the span entered the pool, in milliseconds.
+    int purged; ///< Whether the pages after the header were purged.
+};
+
+/**
+ * @brief Spans of one kind with their own age list and byte cap.
+ */
+struct pool
+{
+    struct pool_span *newest; ///< Most recently pooled span.
+    struct pool_span *oldest; ///< Next span to decay.
+    size_t bytes; ///< Bytes currently pooled.
+};
+
+// log2(POOL_MAX_PAGES)
+#define POOL_MAX_SHIFT 7
+
+// log2 of the number of large bins per power of two of pages
+#define SUB_SHIFT 4
+
+// Exact bins for spans up to POOL_MAX_PAGES, then 1 << SUB_SHIFT bins per
+// power of two of pages for large mappings, and a bit per bin telling if it
+// is non-empty
+#define BIN_COUNT                                                              \
+    (POOL_MAX_PAGES + 1                                                        \
+     + ((sizeof(size_t) * 8 - POOL_MAX_SHIFT) << SUB_SHIFT))
+#define MASK_WORDS ((BIN_COUNT + 63) / 64)
+
+/**
+ * @brief Pooled mappings of one NUMA node, whose pages stay on it.
+ */
+struct node_pool
+{
+    struct blk_allocator bins[BIN_COUNT]; ///< Mappings by length.
+    uint64_t bin_mask[MASK_WORDS]; ///< Bit set per non-empty bin.
+    struct pool spans; ///< Spans, up to POOL_MAX_PAGES.
+    struct pool large; ///< Large mappings.
+};
+
+static struct node_pool nodes[NUMA_MAX_NODES];
+static uint64_t last_decay;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    if (clock_gettime(POOL_CLOCK, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static size_t span_len(const struct pool_span *s)
+{
+    return s->meta.size;
+}
+
+static size_t bin_index(size_t pages)
+{
+    if (pages <= POOL_MAX_PAGES)
+        return pages;
+
+    size_t k = (sizeof(size_t) * 8) - 1 - (size_t)__builtin_clzl(pages);
+    size_t sub = (pages >> (k - SUB_SHIFT)) & (((size_t)1 << SUB_SHIFT) - 1);
+    return POOL_MAX_PAGES + 1 + ((k - POOL_MAX_SHIFT) << SUB_SHIFT) + sub;
+}
+
+// First non-empty bin at or above start, testing a word of the mask at a time
+static size_t first_bin(const struct node_pool *np, size_t start)
+{
+    for (size_t w = start / 64; w < MASK_WORDS; w++)
+    {
+        uint64_t bits = np->bin_mask[w];
+        if (w == start / 64)
+            bits &= ~(uint64_t)0 << (start % 64);
+        if (bits != 0)
+            return w * 64 + (size_t)__builtin_ctzll(bits);
+    }
+    return BIN_COUNT;
+}
+
+static struct pool *pool_of(struct node_pool *np, size_t pages)
+{
+    return pages <= POOL_MAX_PAGES ? &np->spans : &np->large;
+}
+
+static size_t max_bytes_of(size_t pages)
+{
+    return pages <= POOL_MAX_PAGES ? conf.pool_bytes : conf.pool_large_bytes;
+}
+
+static void link_span(struct node_pool *np, struct pool_span *s, size_t pages,
+                      uint64_t now)
+{
+    size_t b = bin_index(pages);
+    struct blk_allocator *bin = &np->bins[b];
+    s->meta.prev = NULL;
+    s->meta.next = bin->meta;
+    if (bin->meta)
+        bin->meta->prev = &s->meta;
+    bin->meta = &s->meta;
+    np->bin_mask[b / 64] |= (uint64_t)1 << (b % 64);
+
+    struct pool *pool = pool_of(np, pages);
+    s->since = now;
+    s->older = pool->newest;
+    s->newer = NULL;
+    if (pool->newest)
+        pool->newest->newer = s;
+    else
+        pool->oldest = s;
+    pool->newest = s;
+
+    pool->bytes += span_len(s);
+}
+
+static void unlink_span(struct node_pool *np, struct pool_span *s,
+                        size_t pages)
+{
+    size_t b = bin_index(pages);
+    struct blk_allocator *bin = &np->bins[b];
+    if (s->meta.prev)
+        s->meta.prev->next = s->meta.next;
+    else
+        bin->meta = s->meta.next;
+    if (s->meta.next)
+        s->meta.next->prev = s->meta.prev;
+    if (bin->meta == NULL)
+        np->bin_mask[b / 64] &= ~((uint64_t)1 << (b % 64));
+
+    struct pool *pool = pool_of(np, pages);
+    if (s->newer)
+        s->newer->older = s->older;
+    else
+        pool->newest = s->older;
+    if (s->older)
+        s->older->newer = s->newer;
+    else
+        pool->oldest = s->newer;
+
+    pool->bytes -= span_len(s);
+}
+
+static void unmap_span(struct node_pool *np, struct pool_span *s, size_t ps)
+{
+    unlink_span(np, s, span_len(s) / ps);
+    blka_unmap(s, span_len(s));
+}
+
+// The first page holds the pool header and stays resident until the unmap
+static void purge_span(struct pool_span *s, size_t ps)
+{
+    size_t len = span_len(s);
+    if (len > ps)
+        madvise((char *)s + ps, len - ps, POOL_PURGE_ADVICE);
+    s->purged = 1;
+}
+
+static void decay_pool(struct node_pool *np, struct pool *pool, size_t ps,
+                       uint64_t now)
+{
+    struct pool_span *s = pool->oldest;
+    while (s != NULL && now - s->since >= conf.purge_ms)
+    {
+        struct pool_span *next = s->newer;
+        if (now - s->since >= conf.unmap_ms)
+            unmap_span(np, s, ps);
+        else if (!s->purged)
+            purge_span(s, ps);
+        s = next;
+    }
+}
+
+// Walks the pools from their oldest span. At most once per clock tick, since
+// every visited span may be waiting for its unmap.
+static void pool_decay(size_t ps, uint64_t now)
+{
+    if (now == last_decay)
+        return;
+    last_decay = now;
+
+    for (size_t n = 0; n < NUMA_MAX_NODES; n++)
+    {
+        decay_pool(&nodes[n], &nodes[n].spans, ps, now);
+        decay_pool(&nodes[n], &nodes[n].large, ps, now);
+    }
+}
+
+// Span of at least the given pages, in constant time. Spans come from the
+// first non-empty exact bin and are split. Large mappings are taken whole,
+// only if they waste at most 1 / POOL_LARGE_SLACK_DIV of the request, since
+// splitting them would leave fragments no later large request fits in.
+static struct pool_span *find_span(struct node_pool *np, size_t pages,
+                                   size_t ps)
+{
+    if (pages <= POOL_MAX_PAGES)
+    {
+        size_t b = first_bin(np, pages);
+        if (b > POOL_MAX_PAGES)
+            return NULL;
+        return (struct pool_span *)np->bins[b].meta;
+    }
+
+    size_t max = pages + pages / POOL_LARGE_SLACK_DIV;
+
+    // The bin of the request may hold shorter mappings, only its head is
+    // tried; every mapping of the bins above is long enough
+    size_t b = bin_index(pages);
+    struct pool_span *s = (struct pool_span *)np->bins[b].meta;
+    if (s != NULL && span_len(s) / ps >= pages && span_len(s) / ps <= max)
+        return s;
+
+    b = first_bin(np, b + 1);
+    if (b == BIN_COUNT)
+        return NULL;
+
+    s = (struct pool_span *)np->bins[b].meta;
+    return span_len(s) / ps <= max ? s : NULL;
+}
+
+void *pool_take(size_t *len_ptr, size_t *zero_from, size_t node)
+{
+    size_t ps = tools_page_size();
+    size_t len = *len_ptr;
+    if (ps == 0 || len == 0 || len % ps != 0 || node >= NUMA_MAX_NODES)
+        return NULL;
+
+    uint64_t now = now_ms();
+    pool_decay(ps, now);
+
+    struct node_pool *np = &nodes[node];
+    size_t pages = len / ps;
+    struct pool_span *s = find_span(np, pages, ps);
+    if (s == NULL)
+        return NULL;
+
+    size_t found = span_len(s) / ps;
+    unlink_span(np, s, found);
+    if (found > pages && pages <= POOL_MAX_PAGES)
+    {
+        // The tail goes back as a span of its own
+        struct pool_span *rest = (struct pool_span *)((char *)s + len);
+        rest->meta.size = (found - pages) * ps;
+        rest->purged = s->purged;
+        link_span(np, rest, found - pages, now);
+    }
+    else
+        len = found * ps;
+
+    *zero_from = len;
+    if (POOL_PURGE_ZEROES && s->purged)
+        *zero_from = ps;
+
+    *len_ptr = len;
+    return s;
+}
+
+void pool_put(void *addr, size_t len, size_t node)
+{
+    size_t ps = tools_page_size();
+    if (ps == 0 || len % ps != 0 || conf.unmap_ms == 0
+        || node >= NUMA_MAX_NODES)
+    {
+        blka_unmap(addr, len);
+        return;
+    }
+
+    struct node_pool *np = &nodes[node];
+    size_t pages = len / ps;
+    struct pool *pool = pool_of(np, pages);
+    size_t max_bytes = max_bytes_of(pages);
+    if (len > max_bytes || (pool == &np->large && len > conf.pool_large_max))
+    {
+        blka_unmap(addr, len);
+        return;
+    }
+
+    while (pool->oldest != NULL && pool->bytes + len > max_bytes)
+        unmap_span(np, pool->oldest, ps);
+
+    struct pool_span *s = addr;
+    s->meta.size = len;
+    s->purged = 0;
+
+    uint64_t now = now_ms();
+    link_span(np, s, pages, now);
+    pool_decay(ps, now);
+}
+
+void pool_release(void)
+{
+    size_t ps = tools_page_size();
+    for (size_t n = 0; n < NUMA_MAX_NODES; n++)
+    {
+        struct node_pool *np = &nodes[n];
+        while (np->spans.oldest != NULL)
+            unmap_span(np, np->spans.oldest, ps);
+        while (np->large.oldest != NULL)
+            unmap_span(np, np->large.oldest, ps);
+    }
+}
+
+size_t pool_bytes(void)
+{
+    size_t bytes = 0;
+    for (size_t n = 0; n < NUMA_MAX_NODES; n++)
+        bytes += nodes[n].spans.bytes + nodes[n].large.bytes;
+    return bytes;
+}
@@ -0,0 +1,106 @@
+#ifndef PAGE_POOL_H
+#define PAGE_POOL_H
+
+#include <stddef.h>
+
+#include "blk_allocator.h"
+
+/**
+ * @brief Age in milliseconds after which the pages of a pooled span are given
+ * back to the kernel with madvise. The span keeps its address range.
+ */
+#ifndef POOL_PURGE_MS
+#    define POOL_PURGE_MS 1000
+#endif
+
+/**
+ * @brief Age in milliseconds after which a pooled span is unmapped. 0 unmaps
+ * empty spans as soon as they are released.
+ */
+#ifndef POOL_UNMAP_MS
+#    define POOL_UNMAP_MS 10000
+#endif
+
+/**
+ * @brief Upper bound on the bytes of spans kept in the pool of a NUMA node,
+ * oldest spans are unmapped first when it is exceeded.
+ */
+#ifndef POOL_MAX_BYTES
+#    define POOL_MAX_BYTES (64 * 1024 * 1024)
+#endif
+
+/**
+ * @brief Longest span binned by exact length, in pages. Longer mappings are
+ * large ones, binned in 16 steps per power of two.
+ */
+#define POOL_MAX_PAGES 128
+
+/**
+ * @brief Upper bound on the bytes of large mappings kept in the pool of a
+ * NUMA node, with its own oldest-first eviction so large buffers do not evict
+ * spans.
+ */
+#ifndef POOL_LARGE_MAX_BYTES
+#    define POOL_LARGE_MAX_BYTES (64 * 1024 * 1024)
+#endif
+
+/**
+ * @brief Largest mapping kept in the pool, bigger ones are unmapped on free.
+ */
+#ifndef POOL_LARGE_MAX_SIZE
+#    define POOL_LARGE_MAX_SIZE (16 * 1024 * 1024)
+#endif
+
+/**
+ * @brief A pooled large mapping serves requests down to 1 / (1 + 1 /
+ * POOL_LARGE_SLACK_DIV) of its length.
+ */
+#define POOL_LARGE_SLACK_DIV 4
+
+/**
+ * @brief Takes a span or large mapping of the given length from the pool of a
+ * NUMA node, splitting a larger one if needed.
+ *
+ * Must be called with the allocator lock held. The pool keeps its header in
+ * the first bytes of the mapping, which are garbage once it is taken. A large
+ * mapping may be returned whole and longer than asked.
+ *
+ * @param len Length of the span in bytes, a multiple of the page size.
+ * Receives the length of the mapping returned.
+ * @param zero_from Receives the offset in the span from which it is known to
+ * be zero-filled, its length if no byte is.
+ * @param node The node whose pages are wanted.
+ * @return The start of the span, or NULL if the pool of the node has none
+ * large enough.
+ */
+void *pool_take(size_t *len, size_t *zero_from, size_t node);
+
+/**
+ * @brief Gives an empty span or large mapping to the pool instead of
+ * unmapping it.
+ *
+ * Must be called with the allocator lock held. Also ages the pool: spans
+ * older than conf.purge_ms are purged and those older than conf.unmap_ms are
+ * unmapped.
+ *
+ * @param addr Start of the mapping, made with blka_map.
+ * @param len Its length, in bytes.
+ * @param node The node its pages were placed on.
+ */
+void pool_put(void *addr, size_t len, size_t node);
+
+/**
+ * @brief Unmaps every span of the pools of all nodes.
+ *
+ * Must be called with the allocator lock held.
+ */
+void pool_release(void);
+
+/**
+ * @brief Returns the bytes of the spans and large mappings in the pool.
+ *
+ * Must be called with the allocator lock held.
+ */
+size_t pool_bytes(void);
+
+#endif /* !PAGE_POOL_H */
@@ -0,0 +1,254 @@
+#ifndef TINYMALLOC_H
+#define TINYMALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief Largest request tinymalloc_malloc resolves at compile time, the
+ * largest class served by the thread caches.
+ */
+#define TINYMALLOC_INLINE_MAX 4096
+
+/**
+ * @brief Returns the thread-cached class of a request, folded to a constant
+ * when the size is one.
+ *
+ * Classes go in 16-byte steps up to 64 bytes, then in four steps per power
+ * of two. The index does not count the 8-byte class of TINY builds.
+ *
+ * @param size The requested size, from 9 to TINYMALLOC_INLINE_MAX bytes.
+ * @return The class index.
+ */
+static inline size_t tinymalloc_size_class(size_t size)
+{
+    if (size <= 64)
+        return (size + 15) / 16 - 1;
+
+    size_t s = size - 1;
+    unsigned shift = 63 - (unsigned)__builtin_clzll((unsigned long long)s) - 2;
+    return 4 + (shift - 4) * 4 + ((s >> shift) - 4);
+}
+
+/**
+ * @brief Allocates a block of a class already resolved by the caller.
+ *
+ * Goes straight to the thread cache, skipping the class lookup of malloc.
+ * Linked from libmalloc.a with -flto, the cache pop is inlined at the call.
+ *
+ * @param cls The class, tinymalloc_size_class(size).
+ * @param size The requested size, in bytes.
+ * @return The block, to be freed with free, or NULL if out of memory.
+ */
+void *tinymalloc_class_malloc(size_t cls, size_t size);
+
+/**
+ * @brief malloc for callers compiled against this header.
+ *
+ * A constant size that a thread cache serves has its class resolved at
+ * compile time, any other request calls malloc.
+ *
+ * @param size The requested size, in bytes.
+ * @return The block, to be freed with free, or NULL if out of memory.
+ */
+static inline void *tinymalloc_malloc(size_t size)
+{
+    if (__builtin_constant_p(size) && size > 8 && size <= TINYMALLOC_INLINE_MAX)
+        return tinymalloc_class_malloc(tinymalloc_size_class(size), size);
+    return malloc(size);
+}
+
+/**
+ * @brief Allocates n blocks of the same size in a single critical section.
+ *
+ * Blocks of a size class are taken from as few spans as possible. Each block
+ * is freed with free or tinymalloc_free_batch.
+ *
+ * @param size The size of each block, in bytes.
+ * @param n Number of blocks wanted.
+ * @param ptrs Array receiving the blocks.
+ * @return The number of blocks stored in ptrs, lower than n only when memory
+ * runs out.
+ */
+size_t tinymalloc_alloc_batch(size_t size, size_t n, void **ptrs);
+
+/**
+ * @brief Frees n blocks in a single critical section.
+ *
+ * The pointers are sorted by address so that the blocks of each page are
+ * given back together. NULL pointers are skipped.
+ *
+ * @param ptrs The blocks to free. The array is reordered and its content is
+ * unspecified afterwards.
+ * @param n Number of pointers in ptrs.
+ */
+void tinymalloc_free_batch(void **ptrs, size_t n);
+
+/**
+ * @brief A bump allocator whose blocks are released all at once, by rewinding
+ * it or destroying it. Not thread-safe: one thread uses it at a time.
+ */
+struct tinymalloc_arena;
+
+/**
+ * @brief A position of an arena, to rewind it to.
+ */
+struct tinymalloc_mark
+{
+    void *chunk; ///< Newest chunk of the arena when the mark was taken.
+    void *top; ///< Its next free byte at the time.
+};
+
+/**
+ * @brief Creates an arena.
+ *
+ * @param chunk_size Length of the mappings the arena bumps through, 0 for
+ * 64 KiB. Larger blocks get a chunk of their own.
+ * @return The arena, or NULL if out of memory.
+ */
+struct tinymalloc_arena *tinymalloc_arena_create(size_t chunk_size);
+
+/**
+ * @brief Allocates a block from an arena, 16-byte aligned.
+ *
+ * Takes the allocator lock only when a new chunk is needed. The block must
+ * not be passed to free, it lives until the arena is rewound past it or
+ * destroyed.
+ *
+ * @param arena The arena.
+ * @param size The size of the block, in bytes.
+ * @return The block, or NULL if out of memory.
+ */
+void *tinymalloc_arena_alloc(struct tinymalloc_arena *arena, size_t size);
+
+/**
+ * @brief Returns the current position of an arena.
+ *
+ * @param arena The arena.
+ * @return A mark for tinymalloc_arena_reset_to_mark.
+ */
+struct tinymalloc_mark tinymalloc_arena_mark(struct tinymalloc_arena *arena);
+
+/**
+ * @brief Releases every block allocated since a mark.
+ *
+ * Chunks added since the mark are released whole, in constant time each.
+ * Marks taken after this one become invalid.
+ *
+ * @param arena The arena.
+ * @param mark A mark of the arena.
+ */
+void tinymalloc_arena_reset_to_mark(struct tinymalloc_arena *arena,
+                                    struct tinymalloc_mark mark);
+
+/**
+ * @brief Releases an arena and all of its blocks.
+ *
+ * @param arena The arena, NULL is ignored.
+ */
+void tinymalloc_arena_destroy(struct tinymalloc_arena *arena);
+
+/**
+ * @brief Gives the free memory held by the allocator back to the system.
+ *
+ * Collects the blocks freed by other threads, empties the thread cache of the
+ * caller and asks the other threads to empty theirs on their next slow path,
+ * then unmaps the empty spans kept for reuse. Also run by malloc_trim, and on
+ * memory pressure when TINYMALLOC_PSI is set.
+ *
+ * @return The number of bytes unmapped.
+ */
+size_t tinymalloc_trim(void);
+
+/**
+ * @brief Sets the soft limit on the memory mapped by the allocator.
+ *
+ * Going over it unmaps the empty spans right away instead of keeping them
+ * for reuse, and asks the thread caches to give their blocks back. Live
+ * blocks are never refused, the limit only stops the allocator from holding
+ * free memory. Defaults to TINYMALLOC_MEM_LIMIT, a number of bytes with an
+ * optional k, m or g suffix.
+ *
+ * @param bytes The limit in bytes, 0 for none.
+ */
+void tinymalloc_set_mem_limit(size_t bytes);
+
+/**
+ * @brief Counters of the global allocator lock.
+ */
+struct tinymalloc_lock_stats
+{
+    uint64_t acquisitions; ///< Number of times the lock was taken.
+    uint64_t contended; ///< Acquisitions that found the lock held.
+    uint64_t sleeps; ///< Number of times a waiter parked on the futex.
+    uint64_t wait_ns; ///< Total time spent waiting for the lock, in ns.
+};
+
+/**
+ * @brief Reads the counters of the global allocator lock.
+ *
+ * The counters are sampled without taking the lock and may be slightly stale.
+ *
+ * @param stats Pointer to the structure to fill.
+ */
+void tinymalloc_lock_stats(struct tinymalloc_lock_stats *stats);
+
+/**
+ * @brief Counters of a size class, or of the large blocks.
+ */
+struct tinymalloc_class_stats
+{
+    uint64_t block_size; ///< Block size of the class, 0 for large blocks.
+    uint64_t spans; ///< Spans, or large mappings, in use.
+    uint64_t mapped_bytes; ///< Bytes of those spans.
+    uint64_t blocks; ///< Blocks carved from them, cached ones included.
+    uint64_t capacity; ///< Blocks they can hold.
+    uint64_t live_blocks; ///< Blocks handed out and not freed yet.
+    uint64_t mallocs; ///< Blocks handed out so far.
+    uint64_t frees; ///< Blocks freed so far.
+    uint64_t requested_bytes; ///< Bytes asked for by those allocations.
+    uint64_t allocated_bytes; ///< Bytes of the blocks they were given.
+};
+
+/**
+ * @brief Totals over every class.
+ */
+struct tinymalloc_stats
+{
+    uint64_t mapped_bytes; ///< Bytes of the spans and large mappings in use.
+    uint64_t pooled_bytes; ///< Bytes of the empty spans kept for reuse.
+    uint64_t meta_bytes; ///< Bytes holding the span headers, out of the spans.
+    uint64_t region_bytes; ///< Bytes of the chunks of the arenas.
+    uint64_t live_bytes; ///< Bytes of the blocks handed out and not freed.
+    uint64_t maps; ///< mmap and mremap calls made so far.
+    uint64_t unmaps; ///< munmap calls made so far.
+};
+
+/**
+ * @brief Returns the number of classes reported by tinymalloc_class_stats,
+ * the last one being the large blocks.
+ */
+size_t tinymalloc_class_count(void);
+
+/**
+ * @brief Reads the counters of a class.
+ *
+ * Allocation counters are kept per thread without atomic operations and
+ * summed here under the allocator lock, so they may lag by a few operations.
+ * A realloc counts as a free and an allocation.
+ *
+ * @param index The class, lower than tinymalloc_class_count().
+ * @param stats Pointer to the structure to fill.
+ * @return 0 on success, -1 if the index is out of range.
+ */
+int tinymalloc_class_stats(size_t index, struct tinymalloc_class_stats *stats);
+
+/**
+ * @brief Reads the totals over every class.
+ *
+ * @param stats Pointer to the structure to fill.
+ */
+void tinymalloc_stats(struct tinymalloc_stats *stats);
+
+#endif /* !TINYMALLOC_H */
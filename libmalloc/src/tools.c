@@ -41,6 +41,43 @@ size_t size_align(size_t size)
     return (size + mask) & ~mask;
 }
 
+// Heapsort: no recursion and no buffer, it may run under the allocator lock
+static void sift_down(void **a, size_t root, size_t n)
+{
+    for (;;)
+    {
+        size_t child = 2 * root + 1;
+        if (child >= n)
+            return;
+        if (child + 1 < n && (uintptr_t)a[child + 1] > (uintptr_t)a[child])
+            child++;
+        if ((uintptr_t)a[root] >= (uintptr_t)a[child])
+            return;
+
+        void *tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+void sort_pointers(void **ptrs, size_t n)
+{
+    if (ptrs == NULL || n < 2)
+        return;
+
+    for (size_t i = n / 2; i-- > 0;)
+        sift_down(ptrs, i, n);
+
+    for (size_t end = n - 1; end > 0; end--)
+    {
+        void *tmp = ptrs[0];
+        ptrs[0] = ptrs[end];
+        ptrs[end] = tmp;
+        sift_down(ptrs, 0, end);
+    }
+}
+
 void *page_begin(void *ptr, size_t page_size)
 {
     if (ptr == NULL)
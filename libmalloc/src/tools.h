@@ -49,4 +49,13 @@ void *page_begin(void *ptr, size_t page_size);
  */
 size_t size_align(size_t size);
 
+/**
+ * @brief Sorts an array of pointers by address, in place and without
+ * allocating.
+ *
+ * @param ptrs The pointers to sort.
+ * @param n Number of pointers in ptrs.
+ */
+void sort_pointers(void **ptrs, size_t n);
+
 #endif // MMA_TOOLS_H
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include <criterion/criterion.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/my_conf.h"
+#include "../src/my_malloc.h"
+#include "../src/my_percpu.h"
+#include "../src/tinymalloc.h"
+
+// Linked with malloc.o: every call below goes through the exported hooks.
+// Built with -fno-builtin, or the compiler would drop malloc and free pairs.
+
+void *aligned_alloc(size_t alignment, size_t size);
+
+static int aligned_to(const void *p, size_t alignment)
+{
+    return ((uintptr_t)p & (alignment - 1)) == 0;
+}
+
+static void class_stats_of(size_t idx, struct tinymalloc_class_stats *c)
+{
+    cr_assert_eq(tinymalloc_class_stats(idx, c), 0);
+}
+
+// Per-CPU caches are shared by the threads of a CPU, a trim only empties
+// the thread caches
+static int thread_cached(void)
+{
+    return !percpu_available();
+}
+
+// Free blocks of a class waiting in the caches
+static uint64_t cached_blocks(const struct tinymalloc_class_stats *c)
+{
+    return c->blocks - c->live_blocks;
+}
+
+Test(hooks, posix_memalign_errors)
+{
+    void *p = (void *)&p;
+    cr_assert_eq(posix_memalign(&p, 0, 16), EINVAL);
+    cr_assert_eq(posix_memalign(&p, 48, 16), EINVAL);
+    cr_assert_eq(posix_memalign(&p, sizeof(void *) / 2, 16), EINVAL);
+    cr_assert_eq(posix_memalign(&p, 64, SIZE_MAX - 4096), ENOMEM);
+    cr_assert_eq(p, (void *)&p, "a failed call wrote the pointer");
+
+    cr_assert_eq(posix_memalign(&p, 64, 100), 0);
+    cr_assert(aligned_to(p, 64));
+    free(p);
+
+    cr_assert_eq(posix_memalign(&p, 8192, 100), 0);
+    cr_assert(aligned_to(p, 8192));
+    memset(p, 1, 100);
+    free(p);
+}
+
+Test(hooks, aligned_alloc_and_memalign)
+{
+    errno = 0;
+    cr_assert_null(aligned_alloc(24, 64));
+    cr_assert_eq(errno, EINVAL);
+
+    void *a = aligned_alloc(256, 256);
+    cr_assert_not_null(a);
+    cr_assert(aligned_to(a, 256));
+
+    void *b = memalign(1 << 16, 1000);
+    cr_assert_not_null(b);
+    cr_assert(aligned_to(b, 1 << 16));
+    memset(b, 1, 1000);
+
+    free(a);
+    free(b);
+}
+
+Test(hooks, usable_size)
+{
+    cr_assert_eq(malloc_usable_size(NULL), 0);
+
+    size_t sizes[] = { 1, 24, 1000, 5000, 300000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        char *p = malloc(sizes[i]);
+        cr_assert_not_null(p);
+        size_t usable = malloc_usable_size(p);
+        cr_assert_geq(usable, sizes[i]);
+        memset(p, 1, usable);
+        free(p);
+    }
+}
+
+Test(hooks, stats_follow_large_blocks)
+{
+    struct tinymalloc_stats before;
+    tinymalloc_stats(&before);
+#if defined(__GLIBC__)                                                         \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi_before = mallinfo2();
+#endif
+
+    size_t size = 1024 * 1024;
+    void *p = malloc(size);
+    cr_assert_not_null(p);
+
+    struct tinymalloc_stats during;
+    tinymalloc_stats(&during);
+    cr_assert_geq(during.live_bytes, before.live_bytes + size);
+    cr_assert_geq(during.mapped_bytes, before.mapped_bytes + size);
+#if defined(__GLIBC__)                                                         \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    cr_assert_eq(mi.hblks, mi_before.hblks + 1);
+    cr_assert_geq(mi.hblkhd, mi_before.hblkhd + size);
+#endif
+
+    free(p);
+    struct tinymalloc_stats after;
+    tinymalloc_stats(&after);
+    cr_assert_eq(after.live_bytes, before.live_bytes);
+}
+
+static void *count_worker(void *arg)
+{
+    void *ptrs[100];
+    for (int i = 0; i < 100; i++)
+        ptrs[i] = malloc(40);
+    for (int i = 0; i < 100; i++)
+        free(ptrs[i]);
+    return arg;
+}
+
+// Each thread counts on its own, and hands its counts over when it exits
+Test(hooks, thread_counters_summed)
+{
+    size_t idx = my_size_class(40);
+    struct tinymalloc_class_stats before;
+    class_stats_of(idx, &before);
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, count_worker, NULL);
+    for (int i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+
+    struct tinymalloc_class_stats after;
+    class_stats_of(idx, &after);
+    cr_assert_eq(after.mallocs - before.mallocs, 400);
+    cr_assert_eq(after.frees - before.frees, 400);
+}
+
+Test(hooks, alloc_and_free_batch)
+{
+    void *ptrs[200];
+    cr_assert_eq(tinymalloc_alloc_batch(64, 200, ptrs), 200);
+    for (size_t i = 0; i < 200; i++)
+    {
+        cr_assert_not_null(ptrs[i]);
+        cr_assert_geq(malloc_usable_size(ptrs[i]), 64);
+        memset(ptrs[i], (int)i, 64);
+    }
+    for (size_t i = 0; i < 200; i++)
+        cr_assert_eq(((unsigned char *)ptrs[i])[63], (unsigned char)i,
+                     "two blocks of the batch overlap");
+
+    // Large blocks too, and NULL pointers are skipped
+    void *large[3];
+    cr_assert_eq(tinymalloc_alloc_batch(512 * 1024, 2, large), 2);
+    large[2] = NULL;
+    tinymalloc_free_batch(large, 3);
+    tinymalloc_free_batch(ptrs, 200);
+}
+
+Test(hooks, trim_releases_pooled_mappings)
+{
+    void *p = malloc(4 * 1024 * 1024);
+    cr_assert_not_null(p);
+    free(p);
+
+    struct tinymalloc_stats s;
+    tinymalloc_stats(&s);
+    cr_assert_gt(s.pooled_bytes, 0);
+
+    cr_assert_gt(tinymalloc_trim(), 0);
+    tinymalloc_stats(&s);
+    cr_assert_eq(s.pooled_bytes, 0);
+
+    p = malloc(4 * 1024 * 1024);
+    free(p);
+    cr_assert_eq(malloc_trim(0), 1);
+    tinymalloc_stats(&s);
+    cr_assert_eq(s.pooled_bytes, 0);
+}
+
+Test(hooks, trim_empties_own_cache)
+{
+    size_t idx = CACHE_CLASS_COUNT - 1;
+    free(malloc(my_class_size(idx)));
+    if (!thread_cached())
+        return;
+
+    struct tinymalloc_class_stats c;
+    class_stats_of(idx, &c);
+    cr_assert_gt(cached_blocks(&c), 0, "the freed block is not cached");
+
+    tinymalloc_trim();
+    class_stats_of(idx, &c);
+    cr_assert_eq(cached_blocks(&c), 0);
+}
+
+static pthread_barrier_t epoch_barrier;
+
+static void *epoch_worker(void *arg)
+{
+    size_t idx = CACHE_CLASS_COUNT - 1;
+    free(malloc(my_class_size(idx)));
+    struct tinymalloc_class_stats *c = arg;
+    class_stats_of(idx, &c[0]);
+
+    // The trim happens here, then a refill of another class takes the slow
+    // path, which flushes the whole cache
+    pthread_barrier_wait(&epoch_barrier);
+    pthread_barrier_wait(&epoch_barrier);
+    free(malloc(my_class_size(idx - 1)));
+    class_stats_of(idx, &c[1]);
+    return NULL;
+}
+
+Test(hooks, epoch_flushes_other_caches)
+{
+    struct tinymalloc_class_stats c[2];
+    pthread_t thread;
+    pthread_barrier_init(&epoch_barrier, NULL, 2);
+    pthread_create(&thread, NULL, epoch_worker, c);
+
+    pthread_barrier_wait(&epoch_barrier);
+    tinymalloc_trim();
+    pthread_barrier_wait(&epoch_barrier);
+    pthread_join(thread, NULL);
+    pthread_barrier_destroy(&epoch_barrier);
+
+    if (!thread_cached())
+        return;
+    cr_assert_gt(cached_blocks(&c[0]), 0, "the freed block is not cached");
+    cr_assert_eq(cached_blocks(&c[1]), 0,
+                 "the cache kept its blocks past the epoch");
+}
+
+Test(hooks, mem_limit_setter)
+{
+    size_t old = conf.mem_limit;
+    tinymalloc_set_mem_limit(64 * 1024 * 1024);
+    cr_assert_eq(conf.mem_limit, 64 * 1024 * 1024);
+
+    void *p = malloc(1024 * 1024);
+    cr_assert_not_null(p);
+    free(p);
+    tinymalloc_set_mem_limit(old);
+}
+
+// The constructor of malloc.o already parsed the environment: later changes
+// are not seen by conf_init
+Test(hooks, conf_parsed_once)
+{
+    struct my_conf before = conf;
+    setenv("TINYMALLOC_CONF", "purge_ms:12345", 1);
+    conf_init();
+    cr_assert_eq(conf.purge_ms, before.purge_ms);
+    unsetenv("TINYMALLOC_CONF");
+}
+
+Test(hooks, conf_overrides_mem_limit_env)
+{
+    struct my_conf c = conf;
+    unsetenv("TINYMALLOC_CONF");
+    setenv("TINYMALLOC_MEM_LIMIT", "3m", 1);
+    conf_read_env(&c);
+    cr_assert_eq(c.mem_limit, 3 * 1024 * 1024);
+
+    setenv("TINYMALLOC_CONF", "mem_limit:5m,stats:0", 1);
+    conf_read_env(&c);
+    cr_assert_eq(c.mem_limit, 5 * 1024 * 1024, "TINYMALLOC_CONF did not win");
+
+    unsetenv("TINYMALLOC_CONF");
+    unsetenv("TINYMALLOC_MEM_LIMIT");
+}
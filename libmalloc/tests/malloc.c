@@ -1,10 +1,24 @@
 #include <criterion/criterion.h>
+#include <pthread.h>
 #include <time.h>
 #include <stdio.h>
 #include <signal.h>
 #include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "../src/my_budget.h"
+#include "../src/my_conf.h"
+#include "../src/my_lock.h"
 #include "../src/my_malloc.h"
+#include "../src/my_numa.h"
+#include "../src/page_map.h"
+#include "../src/my_profile.h"
+#include "../src/my_region.h"
+#include "../src/my_tcache.h"
+#include "../src/tinymalloc.h"
+#include "../src/tools.h"
 
 TestSuite(my_malloc);
 
@@ -84,6 +98,8 @@ Test(my_malloc, segfault_01, .signal = SIGSEGV)
 {
     void *ptr = my_malloc(1);
     my_free(ptr);
+
+    my_trim();
     memset(ptr, 0, 1);
 }
 
@@ -100,6 +116,7 @@ Test(my_malloc, segfault_02, .signal = SIGSEGV)
     void *ptr = my_malloc(1);
     my_free(ptr);
 
+    my_trim();
     memset(ptr, 0, 1);
 }
 
@@ -123,6 +140,7 @@ Test(my_malloc, segfault_03, .signal = SIGSEGV)
     void *ptr = my_malloc(1);
     my_free(ptr);
 
+    my_trim();
     memset(ptr, 0, 1);
 }
 
@@ -146,6 +164,7 @@ Test(my_malloc, segfault_04, .signal = SIGSEGV)
     void *ptr = my_malloc(1);
     my_free(ptr);
 
+    my_trim();
     memset(ptr, 0, 1);
 }
 
@@ -227,6 +246,55 @@ Test(my_malloc, realloc_zero_size)
     my_free(new_ptr);
 }
 
+Test(my_malloc, realloc_large_grow_keeps_data)
+{
+    size_t size = 512 * 1024;
+    unsigned char *p = my_malloc(size);
+    cr_assert_not_null(p);
+    for (size_t i = 0; i < size; i++)
+        p[i] = (unsigned char)i;
+
+    p = my_realloc(p, 8 * size);
+    cr_assert_not_null(p);
+    for (size_t i = 0; i < size; i++)
+        cr_assert_eq(p[i], (unsigned char)i);
+    memset(p + size, 0, 7 * size);
+
+    my_free(p);
+}
+
+Test(my_malloc, realloc_large_shrink_trims, .signal = SIGSEGV)
+{
+    size_t size = 1024 * 1024;
+    char *p = my_malloc(size);
+    cr_assert_not_null(p);
+    memset(p, 1, size);
+
+    char *q = my_realloc(p, size / 2);
+    cr_assert_eq(q, p);
+    cr_assert_eq(q[size / 2 - 1], 1);
+
+    // The tail was unmapped in place
+    p[size - 1] = 1;
+}
+
+Test(my_malloc, realloc_shrink_moves_class)
+{
+    char *p = my_malloc(1000);
+    cr_assert_not_null(p);
+    memset(p, 'x', 1000);
+
+    char *q = my_realloc(p, 100);
+    cr_assert_not_null(q);
+    cr_assert_neq(q, p);
+    cr_assert_eq(my_block_class(q), my_size_class(100));
+    cr_assert_eq(q[99], 'x');
+
+    // A small shrink keeps the block
+    cr_assert_eq(my_realloc(q, 90), q);
+    my_free(q);
+}
+
 Test(my_malloc, stress_large_block_malloc_free)
 {
     const int iterations = 10; // Fewer iterations due to large size
@@ -345,3 +413,658 @@ Test(my_malloc, mixed_all_functions)
     // Print the elapsed time
     printf("BENCH_MIX_2: %.2f seconds\n", elapsed_time);
 }
+
+Test(my_malloc, size_class_table)
+{
+    cr_assert_eq(my_class_size(my_size_class(129)), 160);
+    cr_assert_eq(my_class_size(my_size_class(1)),
+                 MIN_BLOCK_SIZE >> TINY_CLASS_COUNT);
+
+    // Every class is the smallest one holding its own size
+    for (size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        size_t size = my_class_size(i);
+        cr_assert_eq(my_size_class(size), i);
+        if (i > 0)
+            cr_assert_eq(my_size_class(my_class_size(i - 1) + 1), i);
+    }
+}
+
+Test(my_malloc, inline_size_class)
+{
+    // The header's class formula agrees with the tables for every size it
+    // resolves
+    for (size_t size = 9; size <= TINYMALLOC_INLINE_MAX; size++)
+    {
+        size_t idx = tinymalloc_size_class(size) + TINY_CLASS_COUNT;
+        cr_assert_eq(idx, my_size_class(size), "size %zu", size);
+        cr_assert_lt(idx, CACHE_CLASS_COUNT);
+    }
+}
+
+Test(my_malloc, medium_classes_share_span)
+{
+    size_t idx = my_size_class(1100);
+    cr_assert_lt(idx, BUCKET_COUNT);
+    cr_assert_eq(my_class_size(idx), 1280);
+    cr_assert_eq(my_size_class(LARGE_THRESHOLD + 1), BUCKET_COUNT);
+
+    char *a = my_malloc(1100);
+    char *b = my_malloc(1100);
+    cr_assert_not_null(a);
+    cr_assert_not_null(b);
+    cr_assert_eq(b - a, 1280, "medium blocks were not carved from one span");
+    cr_assert_eq(my_block_class(b), idx);
+
+    memset(a, 'a', 1100);
+    memset(b, 'b', 1100);
+    cr_assert_eq(a[1099], 'a');
+
+    my_free(a);
+    my_free(b);
+}
+
+Test(my_malloc, span_keeps_header_lookup, .signal = SIGSEGV)
+{
+    // The last block of a multi-page span lives pages away from its start
+    size_t idx = my_size_class(4096);
+    void *ptrs[16];
+    size_t n = my_malloc_batch(idx, ptrs, 16, 0);
+    cr_assert_gt(n, 1);
+    cr_assert_eq(my_block_class(ptrs[n - 1]), idx);
+
+    for (size_t i = 0; i < n; i++)
+        my_free(ptrs[i]);
+
+    // Every block is back, the span is pooled and then unmapped
+    my_trim();
+    *(volatile char *)ptrs[0] = 1;
+}
+
+Test(my_malloc, empty_span_reused_across_classes)
+{
+    // Both classes fit in single-page spans
+    char *a = my_malloc(16);
+    cr_assert_not_null(a);
+    my_free(a);
+
+    // The first block of a class sits at the start of the span
+    uintptr_t page = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+    char *b = my_malloc(32);
+    cr_assert_not_null(b);
+    cr_assert_eq((uintptr_t)b & page, (uintptr_t)a & page,
+                 "the pooled span was not reused");
+    cr_assert_eq(my_block_class(b), my_size_class(32));
+
+    memset(b, 0, 32);
+    my_free(b);
+}
+
+Test(my_malloc, large_mapping_reused)
+{
+    size_t size = 1024 * 1024;
+    char *a = my_malloc(size);
+    cr_assert_not_null(a);
+    memset(a, 1, size);
+    my_free(a);
+
+    // Within the slack of the cached mapping, so it is taken whole
+    char *b = my_malloc(size - 64 * 1024);
+    cr_assert_eq(b, a, "the cached large mapping was not reused");
+    cr_assert_eq(my_block_class(b), BUCKET_COUNT);
+    memset(b, 2, size - 64 * 1024);
+    my_free(b);
+}
+
+Test(my_malloc, headers_out_of_band)
+{
+    // A page-sized class fills its span from the first byte, with no header
+    // in front of its blocks
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    char *p = my_malloc(4096);
+    cr_assert_not_null(p);
+    cr_assert_eq((uintptr_t)p & page, 0);
+
+    struct blk_meta *m = pagemap_get(p);
+    struct recycler *r = (struct recycler *)(m + 1);
+    cr_assert_eq(r->chunk, p);
+    cr_assert((char *)m < p
+              || (char *)m >= p + m->size + sizeof(struct blk_meta),
+              "the header lives in the span");
+
+    // Interior and foreign pointers are not blocks
+    cr_assert_not(recycler_owns_block(r, p + 16));
+    int local;
+    cr_assert_null(pagemap_get(&local));
+    my_free(&local);
+
+    memset(p, 0xff, 4096);
+    my_free(p);
+}
+
+Test(my_malloc, double_free_ignored)
+{
+    void *keep = my_malloc(16);
+    void *a = my_malloc(16);
+    my_free(a);
+    my_free(a);
+
+    void *c = my_malloc(16);
+    void *d = my_malloc(16);
+    cr_assert_eq(c, a);
+    cr_assert_neq(d, a, "a double free handed the block out twice");
+
+    struct recycler *r = (struct recycler *)(pagemap_get(c) + 1);
+    cr_assert(recycler_owns_block(r, c));
+    cr_assert_not(recycler_owns_block(r, (char *)c + 8));
+
+    my_free(c);
+    cr_assert_not(recycler_owns_block(r, c));
+
+    my_free(d);
+    my_free(keep);
+}
+
+Test(my_malloc, pages_on_current_node)
+{
+    size_t node = numa_node();
+    cr_assert_lt(node, numa_node_count());
+
+    void *p = my_malloc(100);
+    void *big = my_malloc(1024 * 1024);
+    cr_assert_not_null(p);
+    cr_assert_not_null(big);
+
+    struct recycler *r = (struct recycler *)(pagemap_get(p) + 1);
+    cr_assert_eq(r->node, node);
+    r = (struct recycler *)(pagemap_get(big) + 1);
+    cr_assert_eq(r->node, node);
+
+    // A large mapping freed on the node is served again from its pool
+    my_free(big);
+    void *again = my_malloc(1024 * 1024);
+    cr_assert_eq(again, big);
+
+    my_free(again);
+    my_free(p);
+}
+
+Test(my_malloc, free_batch_by_page)
+{
+    size_t idx = my_size_class(64);
+    struct my_class_usage before;
+    struct my_class_usage after;
+    my_class_usage(idx, &before);
+
+    // Enough blocks for several spans, freed in an interleaved order
+    void *blocks[600];
+    cr_assert_eq(my_malloc_batch(idx, blocks, 600, 0), 600);
+    for (size_t i = 0; i < 300; i++)
+    {
+        void *tmp = blocks[i];
+        blocks[i] = blocks[599 - i];
+        blocks[599 - i] = tmp;
+    }
+
+    sort_pointers(blocks, 600);
+    for (size_t i = 1; i < 600; i++)
+        cr_assert_lt((uintptr_t)blocks[i - 1], (uintptr_t)blocks[i]);
+
+    my_free_batch(blocks, 600);
+    my_class_usage(idx, &after);
+    cr_assert_eq(after.blocks, before.blocks);
+    cr_assert_leq(after.spans, before.spans);
+}
+
+// A transparent huge page faults in its whole 2 MiB at once
+#ifndef MY_HUGE_PAGES
+Test(my_malloc, fresh_span_not_touched)
+{
+    // One block of a multi-page span must not fault in the other blocks
+    char *p = my_malloc(8000);
+    cr_assert_not_null(p);
+
+    size_t ps = (size_t)sysconf(_SC_PAGESIZE);
+    char *third = (char *)(((uintptr_t)p + 2 * 8192) & ~(uintptr_t)(ps - 1));
+    unsigned char vec = 1;
+    cr_assert_eq(mincore(third, ps, &vec), 0);
+    cr_assert_eq(vec & 1, 0, "a page of the span was touched");
+
+    my_free(p);
+}
+
+Test(my_malloc, calloc_fresh_not_touched)
+{
+    // A fresh mapping is known to be zero, calloc must not write to it
+    char *p = my_calloc(1, 1024 * 1024);
+    cr_assert_not_null(p);
+
+    size_t ps = (size_t)sysconf(_SC_PAGESIZE);
+    char *mid = (char *)(((uintptr_t)p + 512 * 1024) & ~(uintptr_t)(ps - 1));
+    unsigned char vec = 1;
+    cr_assert_eq(mincore(mid, ps, &vec), 0);
+    cr_assert_eq(vec & 1, 0, "calloc cleared a fresh mapping");
+    cr_assert_eq(mid[0], 0);
+
+    my_free(p);
+}
+#endif
+
+Test(my_malloc, calloc_recycled_zeroed)
+{
+    size_t sizes[] = { 100, 20000, 1024 * 1024 + 100 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        char *p = my_malloc(sizes[i]);
+        cr_assert_not_null(p);
+        memset(p, 0xff, sizes[i]);
+        my_free(p);
+
+        // Reuses the dirty block, or its pooled mapping
+        char *q = my_calloc(1, sizes[i]);
+        cr_assert_not_null(q);
+        for (size_t j = 0; j < sizes[i]; j++)
+            cr_assert_eq(q[j], 0);
+        my_free(q);
+    }
+}
+
+Test(my_malloc, memalign_uses_classes)
+{
+    size_t aligns[] = { 16, 64, 256, 4096 };
+    for (size_t i = 0; i < sizeof(aligns) / sizeof(aligns[0]); i++)
+    {
+        void *p[8];
+        for (size_t j = 0; j < 8; j++)
+        {
+            p[j] = my_memalign(aligns[i], 100);
+            cr_assert_not_null(p[j]);
+            cr_assert_eq((uintptr_t)p[j] % aligns[i], 0);
+            memset(p[j], 1, 100);
+        }
+
+        // No padding: the block is a class block, not a large mapping
+        cr_assert_lt(my_block_class(p[0]), BUCKET_COUNT);
+        cr_assert_eq(my_class_size(my_block_class(p[0])) % aligns[i], 0);
+
+        for (size_t j = 0; j < 8; j++)
+            my_free(p[j]);
+    }
+
+    cr_assert_null(my_memalign(48, 100));
+}
+
+Test(my_malloc, memalign_large_alignment)
+{
+    size_t align = 64 * 1024;
+    char *a = my_memalign(align, 100);
+    char *b = my_memalign(align, 1024 * 1024);
+    cr_assert_not_null(a);
+    cr_assert_not_null(b);
+    cr_assert_eq((uintptr_t)a % align, 0);
+    cr_assert_eq((uintptr_t)b % align, 0);
+    cr_assert_eq(my_block_class(b), BUCKET_COUNT);
+
+    memset(b, 2, 1024 * 1024);
+    b = my_realloc(b, 2 * 1024 * 1024);
+    cr_assert_not_null(b);
+    cr_assert_eq(b[1024 * 1024 - 1], 2);
+
+    my_free(a);
+    my_free(b);
+}
+
+Test(my_malloc, usable_size)
+{
+    cr_assert_eq(my_usable_size(NULL), 0);
+
+    char *p = my_malloc(100);
+    cr_assert_eq(my_usable_size(p), my_class_size(my_size_class(100)));
+    memset(p, 3, my_usable_size(p));
+    my_free(p);
+
+    p = my_malloc(1024 * 1024 + 1);
+    cr_assert_geq(my_usable_size(p), 1024 * 1024 + 1);
+    my_free(p);
+}
+
+#ifdef MY_HUGE_PAGES
+Test(my_malloc, spans_share_huge_region)
+{
+    // Spans of different classes are carved from one 2 MiB region
+    char *a = my_malloc(16);
+    char *b = my_malloc(48 * 1024);
+    cr_assert_not_null(a);
+    cr_assert_not_null(b);
+    cr_assert_eq((uintptr_t)a / (2 * 1024 * 1024),
+                 (uintptr_t)b / (2 * 1024 * 1024));
+    cr_assert_eq(my_block_class(b), my_size_class(48 * 1024));
+
+    char *c = my_malloc(4 * 1024 * 1024);
+    cr_assert_not_null(c);
+    memset(c, 1, 4 * 1024 * 1024);
+
+    my_free(a);
+    my_free(b);
+    my_free(c);
+}
+#endif
+
+Test(my_malloc, class_usage_counts_blocks)
+{
+    size_t idx = my_size_class(20000);
+    struct my_class_usage before;
+    struct my_class_usage after;
+    my_class_usage(idx, &before);
+
+    void *p = my_malloc(20000);
+    void *q = my_malloc(20000);
+    char *big = my_malloc(1024 * 1024);
+    cr_assert_not_null(p);
+    cr_assert_not_null(q);
+    cr_assert_not_null(big);
+
+    my_class_usage(idx, &after);
+    cr_assert_eq(after.blocks, before.blocks + 2);
+    cr_assert_eq(after.block_bytes, before.block_bytes
+                 + 2 * my_class_size(idx));
+    cr_assert_geq(after.spans, 1);
+    cr_assert_geq(after.bytes, after.capacity * my_class_size(idx));
+
+    my_class_usage(BUCKET_COUNT, &after);
+    cr_assert_eq(after.spans, 1);
+    cr_assert_eq(after.block_bytes, 1024 * 1024);
+
+    my_free(p);
+    my_free(q);
+    my_free(big);
+
+    my_class_usage(idx, &after);
+    cr_assert_eq(after.blocks, before.blocks);
+    my_class_usage(BUCKET_COUNT, &after);
+    cr_assert_eq(after.spans, 0);
+    cr_assert_eq(after.bytes, 0);
+}
+
+Test(my_malloc, remote_free_collected_on_refill)
+{
+    void *ptrs[4];
+    size_t idx = my_size_class(32);
+    cr_assert_eq(my_malloc_batch(idx, ptrs, 4, 1), 4);
+    cr_assert_eq(my_block_owner(ptrs[0]), 1);
+
+    my_free_remote(ptrs[3]);
+
+    void *again = NULL;
+    cr_assert_eq(my_malloc_batch(idx, &again, 1, 1), 1);
+    cr_assert_eq(again, ptrs[3], "remote free was not collected on refill");
+
+    for (int i = 0; i < 4; i++)
+        my_free(ptrs[i]);
+}
+
+Test(my_malloc, remote_free_releases_page, .signal = SIGSEGV)
+{
+    void *ptr = my_malloc(1);
+    my_free_remote(ptr);
+    my_remote_collect();
+
+    my_trim();
+    memset(ptr, 0, 1);
+}
+
+Test(my_malloc, remote_double_free_dropped)
+{
+    void *ptrs[4];
+    size_t idx = my_size_class(48);
+    cr_assert_eq(my_malloc_batch(idx, ptrs, 4, 1), 4);
+
+    my_free_remote(ptrs[3]);
+    my_free_remote(ptrs[3]);
+
+    void *again[2];
+    cr_assert_eq(my_malloc_batch(idx, again, 2, 1), 2);
+    cr_assert_eq(again[0], ptrs[3]);
+    cr_assert_neq(again[1], ptrs[3], "a double free handed the block out twice");
+
+    // Not allocated any more, so not taken back either
+    my_free(again[0]);
+    my_free_remote(again[0]);
+    my_remote_collect();
+
+    for (int i = 0; i < 3; i++)
+        my_free(ptrs[i]);
+    my_free(again[1]);
+}
+
+Test(my_malloc, corrupt_free_list_dropped)
+{
+    void *keep = my_malloc(16);
+    void *a = my_malloc(16);
+    my_free(a);
+    *(void **)a = (char *)keep + 8;
+
+    cr_assert_eq(my_malloc(16), a);
+    void *b = my_malloc(16);
+    cr_assert_not_null(b, "a corrupt free list left the class stuck");
+    cr_assert_neq(b, keep);
+
+    my_free(b);
+    my_free(a);
+    my_free(keep);
+}
+
+Test(my_tcache, refill_and_reuse)
+{
+    struct tcache tc;
+    tcache_init(&tc);
+
+    size_t idx = my_size_class(24);
+    cr_assert_null(tcache_alloc(&tc, idx), "fresh cache should be empty");
+    cr_assert_gt(tcache_refill(&tc, idx), 0, "refill did not fetch any block");
+
+    void *ptr = tcache_alloc(&tc, idx);
+    cr_assert_not_null(ptr);
+    memset(ptr, 0, 24);
+
+    cr_assert(tcache_free(&tc, idx, ptr));
+    cr_assert(tcache_free(&tc, idx, ptr), "double free should be dropped");
+    cr_assert_eq(tcache_alloc(&tc, idx), ptr, "cache is not LIFO");
+    cr_assert_neq(tcache_alloc(&tc, idx), ptr, "double free was cached twice");
+
+    tcache_destroy(&tc);
+}
+
+Test(my_tcache, flush_when_full)
+{
+    struct tcache tc;
+    tcache_init(&tc);
+
+    size_t idx = my_size_class(100);
+    size_t limit = tc.bins[idx].limit;
+    void *ptrs[TCACHE_MAX_COUNT + 1];
+
+    for (size_t i = 0; i <= limit; i++)
+    {
+        ptrs[i] = my_malloc(100);
+        cr_assert_not_null(ptrs[i]);
+    }
+
+    for (size_t i = 0; i < limit; i++)
+        cr_assert(tcache_free(&tc, idx, ptrs[i]));
+    cr_assert_not(tcache_free(&tc, idx, ptrs[limit]), "bin exceeded its limit");
+
+    tcache_flush(&tc, idx);
+    cr_assert_eq(tc.bins[idx].count, limit / 2);
+    cr_assert(tcache_free(&tc, idx, ptrs[limit]));
+
+    tcache_destroy(&tc);
+}
+
+Test(my_tcache, destroy_returns_pages, .signal = SIGSEGV)
+{
+    struct tcache tc;
+    tcache_init(&tc);
+
+    size_t idx = my_size_class(1);
+    tcache_refill(&tc, idx);
+    void *ptr = tcache_alloc(&tc, idx);
+    tcache_free(&tc, idx, ptr);
+    tcache_destroy(&tc);
+
+    my_trim();
+    memset(ptr, 0, 1);
+}
+
+Test(my_profile, live_and_cumulative)
+{
+    // Every allocation is sampled, the blocks only serve as keys
+    static char blocks[3][100];
+    cr_assert_eq(profile_start(1), 0);
+    for (int i = 0; i < 3; i++)
+        profile_record(blocks[i], sizeof(blocks[i]));
+    profile_free(blocks[1]);
+    profile_free(blocks[1]);
+
+    char path[] = "/tmp/tinymalloc_prof_XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+    cr_assert_eq(profile_dump(path), 0);
+
+    char line[128] = { 0 };
+    FILE *f = fopen(path, "r");
+    cr_assert_not_null(f);
+    cr_assert_not_null(fgets(line, sizeof(line), f));
+    fclose(f);
+    unlink(path);
+
+    cr_assert_str_eq(line, "heap profile: 2: 200 [3: 300] @ heap_v2/1\n");
+}
+
+Test(my_region, bump_mark_reset)
+{
+    struct region *r = region_create(0);
+    cr_assert_not_null(r);
+
+    char *a = region_alloc(r, 10);
+    cr_assert_not_null(a);
+    struct region_mark mark = region_mark(r);
+    char *b = region_alloc(r, 1);
+    cr_assert_eq(b, a + 16, "blocks are bumped, 16-byte aligned");
+
+    // A block longer than a chunk gets one of its own
+    cr_assert_null(region_alloc(r, REGION_CHUNK_SIZE));
+    cr_assert_eq(region_grow(r, REGION_CHUNK_SIZE), 0);
+    char *big = region_alloc(r, REGION_CHUNK_SIZE);
+    cr_assert_not_null(big);
+    memset(big, 1, REGION_CHUNK_SIZE);
+
+    region_reset(r, mark);
+    cr_assert_eq(r->chunks.meta->next, NULL, "newer chunks are released");
+    cr_assert_eq(region_alloc(r, 1), b);
+
+    region_destroy(r);
+}
+
+Test(my_region, chunks_counted)
+{
+    size_t before = region_bytes();
+    struct region *r = region_create(0);
+    cr_assert_not_null(r);
+    cr_assert_eq(region_bytes(), before + REGION_CHUNK_SIZE);
+
+    cr_assert_eq(region_grow(r, 2 * REGION_CHUNK_SIZE), 0);
+    cr_assert_gt(region_bytes(), before + 3 * REGION_CHUNK_SIZE);
+
+    struct my_heap_usage h;
+    my_heap_usage(&h);
+    cr_assert_eq(h.region_bytes, region_bytes());
+
+    region_destroy(r);
+    cr_assert_eq(region_bytes(), before);
+}
+
+static struct my_lock test_lock = MY_LOCK_INIT;
+static long test_counter = 0;
+
+static void *lock_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < 100000; i++)
+    {
+        lock_acquire(&test_lock);
+        test_counter++;
+        lock_release(&test_lock);
+    }
+    return NULL;
+}
+
+Test(my_lock, mutual_exclusion)
+{
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, lock_worker, NULL);
+    for (int i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+
+    cr_assert_eq(test_counter, 400000, "lost updates under the lock");
+    cr_assert_eq(test_lock.acquisitions, 400000);
+    cr_assert_leq(test_lock.contended, test_lock.acquisitions);
+    cr_assert_eq(atomic_load(&test_lock.state), LOCK_FREE);
+}
+
+Test(my_budget, limit_unmaps_empty_mappings)
+{
+    // Under no limit, a freed large mapping is kept for reuse
+    struct my_heap_usage h;
+    char *p = my_malloc(1024 * 1024);
+    cr_assert_not_null(p);
+    my_free(p);
+    my_heap_usage(&h);
+    cr_assert_gt(h.pooled_bytes, 0);
+
+    // Over it, the pool is emptied and the caches are asked to flush
+    unsigned epoch = budget_epoch;
+    conf.mem_limit = 1;
+    p = my_malloc(1024 * 1024);
+    cr_assert_not_null(p, "the limit refused a live block");
+    my_free(p);
+    my_heap_usage(&h);
+    cr_assert_eq(h.pooled_bytes, 0);
+    cr_assert_neq(budget_epoch, epoch);
+
+    // Still over it, the caches are left alone for a while
+    epoch = budget_epoch;
+    p = my_malloc(1024 * 1024);
+    cr_assert_not_null(p);
+    my_free(p);
+    cr_assert_eq(budget_epoch, epoch, "the caches were flushed again at once");
+    conf.mem_limit = 0;
+}
+
+Test(my_conf, parse_pairs)
+{
+    size_t size = 0;
+    cr_assert_eq(conf_parse_size("64k", 3, &size), 0);
+    cr_assert_eq(size, 64 * 1024);
+    cr_assert_eq(conf_parse_size("3M", 2, &size), 0);
+    cr_assert_eq(size, 3 * 1024 * 1024);
+    cr_assert_eq(conf_parse_size("12x", 3, &size), -1);
+    cr_assert_eq(conf_parse_size("k", 1, &size), -1);
+
+    struct my_conf c = conf;
+    size_t skipped = conf_parse(&c, "large_threshold:64k,purge_ms:0,,"
+                                    "stats:1,bogus:1,span_max_pages:0");
+    cr_assert_eq(skipped, 2);
+    cr_assert_eq(c.large_threshold, 64 * 1024);
+    cr_assert_eq(c.purge_ms, 0);
+    cr_assert_eq(c.stats, 1);
+    cr_assert_eq(c.span_max_pages, conf.span_max_pages,
+                 "an out-of-range value was applied");
+
+    c = conf;
+    cr_assert_eq(conf_parse(&c, "tcache_max:8,tcache_min:64"), 0);
+    cr_assert_eq(c.tcache_max, 8);
+    cr_assert_eq(c.tcache_min, 8, "tcache_min was left above tcache_max");
+}